@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "gemm.h"
+#include "threadpool.h"
+
+
+typedef void (*Kernel)(int, int, int, const double*, int, const double*, int, double*, int);
+
+// Floating point operations each kernel is timed over, at least
+static constexpr double WORK = 2e9;
+
+static std::vector<double> randomMatrix(int rows, int cols, std::mt19937& gen) {
+    std::uniform_real_distribution<double> dist(0, 1);
+    std::vector<double> res(std::size_t(rows) * cols);
+    for (double& x : res)
+        x = dist(gen);
+    return res;
+}
+
+// GFLOP/s of kernel on n x n matrices, best of 3 batches
+static double gflops(Kernel kernel, int n, const std::vector<double>& a,
+                     const std::vector<double>& b, std::vector<double>& c) {
+    double flops = 2.0 * n * n * n;
+    int reps = std::max(1, int(WORK / flops / 3));
+    double best = 0;
+    for (int batch = 0; batch < 3; batch++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < reps; rep++)
+            kernel(n, n, n, a.data(), n, b.data(), n, c.data(), n);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, flops * reps / elapsed.count() / 1e9);
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    threadPool().resize(1);
+    std::mt19937 gen(1);
+
+    std::printf("%5s %10s %10s %10s\n", "n", "naive", "blocked", "max |diff|");
+    for (int n : { 64, 128, 256, 333, 512, 1000 }) {
+        std::vector<double> a = randomMatrix(n, n, gen);
+        std::vector<double> b = randomMatrix(n, n, gen);
+        std::vector<double> naive(std::size_t(n) * n), blocked(std::size_t(n) * n);
+        double slow = gflops(gemmNaive, n, a, b, naive);
+        double fast = gflops(gemm, n, a, b, blocked);
+        double diff = 0;
+        for (std::size_t i = 0; i < naive.size(); i++)
+            diff = std::max(diff, std::abs(naive[i] - blocked[i]));
+        std::printf("%5d %10.2f %10.2f %10.1e\n", n, slow, fast, diff);
+    }
+    std::printf("GFLOP/s, 1 thread\n");
+
+    // Scaling with the pool size: powers of two up to the hardware
+    // threads, or up to the argument, and that number itself
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned most = argc > 1 ? std::max(1, std::atoi(argv[1])) : cores;
+    std::vector<unsigned> sizes;
+    for (unsigned threads = 1; threads < most; threads *= 2)
+        sizes.push_back(threads);
+    sizes.push_back(most);
+    int n = 1000;
+    std::vector<double> a = randomMatrix(n, n, gen);
+    std::vector<double> b = randomMatrix(n, n, gen);
+    std::vector<double> c(std::size_t(n) * n);
+    std::printf("\n%7s %10s %8s\n", "threads", "blocked", "speedup");
+    double serial = 0;
+    for (unsigned threads : sizes) {
+        threadPool().resize(threads);
+        double rate = gflops(gemm, n, a, b, c);
+        if (threads == 1)
+            serial = rate;
+        std::printf("%7u %10.2f %7.2fx\n", threads, rate, rate / serial);
+    }
+    std::printf("GFLOP/s, n = %d, %u hardware threads\n", n, cores);
+    if (cores == 1)
+        std::printf("One hardware thread: more threads only take turns, so "
+                    "scaling is not measured here\n");
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "pmap.h"
+#include "types.h"
+
+
+// Lookups per second in a map from keys[i] to i. Each of probes, which
+// are equal to the keys, is looked up once per round.
+static void report(const char* kind, const std::vector<ObPtr>& keys,
+                   const std::vector<ObPtr>& probes, int rounds) {
+    PersistentMap::Builder builder;
+    for (std::size_t i = 0; i < keys.size(); i++)
+        builder.set(keys[i], newInteger(i));
+    PersistentMap map = builder.persistent();
+
+    long long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+        for (const ObPtr& probe : probes)
+            sum += map.find(probe)->integerValue();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    long long expected = (long long)keys.size() * (keys.size() - 1) / 2 * rounds;
+    std::printf("%-12s %9zu %12.2f%s\n", kind, keys.size(),
+                probes.size() * rounds / elapsed.count() / 1e6,
+                sum == expected ? "" : "  WRONG");
+}
+
+static void symbolKeys(std::size_t count, int rounds) {
+    std::vector<ObPtr> keys;
+    for (std::size_t i = 0; i < count; i++)
+        keys.push_back(newSymbol("key" + std::to_string(i)));
+    // Symbols are interned, so a program looks up the key itself
+    report("symbol", keys, keys, rounds);
+}
+
+// Probes are copies, which hash their items again, as the vectors a
+// program builds to look up would
+static void vectorKeys(std::size_t count, int size) {
+    std::vector<ObPtr> keys, probes;
+    for (std::size_t i = 0; i < count; i++) {
+        std::vector<ObPtr> items;
+        for (int j = 0; j < size; j++)
+            items.push_back(newInteger(i * size + j));
+        keys.push_back(newVector(items.cbegin(), items.cend()));
+        probes.push_back(newVector(items.cbegin(), items.cend()));
+    }
+    report(("vector[" + std::to_string(size) + "]").c_str(), keys, probes, 1);
+}
+
+int main() {
+    std::printf("%-12s %9s %12s\n", "map keys", "count", "M lookups/s");
+    symbolKeys(100000, 20);
+    symbolKeys(1000000, 5);
+    vectorKeys(100000, 64);
+    return 0;
+}
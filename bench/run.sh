@@ -0,0 +1,43 @@
+#!/bin/bash
+# Times the benchmark scripts, printing the best wall time of RUNS runs
+# (3 by default) for each.
+#
+#   bench/run.sh [interpreter [script ...]]
+#
+# The interpreter defaults to ./interpreter and the scripts to every
+# other file in bench/. A .mal file is run as it is; a .sh file prints
+# the program to run, one form per line. Programs go in on stdin, which
+# builds from before script mode also read. ENGINE=vm or ENGINE=tree
+# picks the engine, and MAL_THREADS sizes the matrix thread pool.
+
+dir=$(dirname "$0")
+interpreter=${1:-./interpreter}
+[ $# -gt 0 ] && shift
+scripts=("$@")
+if [ ${#scripts[@]} -eq 0 ]; then
+    for f in "$dir"/*.mal "$dir"/*.sh; do
+        [ "$f" != "$dir/run.sh" ] && scripts+=("$f")
+    done
+fi
+
+program=$(mktemp)
+trap 'rm -f "$program"' EXIT
+TIMEFORMAT=%R
+engine=()
+[ -n "$ENGINE" ] && engine=(--engine=$ENGINE)
+
+for script in "${scripts[@]}"; do
+    case $script in
+        *.sh) bash "$script" > "$program" ;;
+        *)    cp "$script" "$program" ;;
+    esac
+    best=
+    for ((run = 0; run < ${RUNS:-3}; run++)); do
+        t=$( { time "$interpreter" "${engine[@]}" < "$program" > /dev/null; } 2>&1 ) ||
+            { best=failed; break; }
+        if [ -z "$best" ] || [ "$(echo "$t < $best" | awk '{ print ($1 < $3) }')" = 1 ]; then
+            best=$t
+        fi
+    done
+    printf '%-28s %s\n' "$(basename "$script")" "$best"
+done
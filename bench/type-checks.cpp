@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "types.h"
+
+
+static constexpr int ROUNDS = 20000;
+
+// Nanoseconds per object that check takes, over all of objects
+template<typename Check>
+static double nsPerCheck(const std::vector<Object*>& objects, Check check, long& count) {
+    count = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++)
+        for (Object* object : objects)
+            count += check(object);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ROUNDS / objects.size();
+}
+
+template<typename T>
+static void compare(const char* what, const std::vector<Object*>& objects) {
+    long tags, rtti;
+    double tag = nsPerCheck(objects, [](Object* object) { return object->is<T>(); }, tags);
+    double cast = nsPerCheck(objects,
+            [](Object* object) { return dynamic_cast<T*>(object) != nullptr; }, rtti);
+    std::printf("%-16s %8.2f %8.2f%s\n", what, tag, cast, tags == rtti ? "" : "  MISMATCH");
+}
+
+// as<T> on objects that are all a T, against the dynamic_cast and check
+// it replaced
+template<typename T>
+static void compareAs(const char* what, const std::vector<Object*>& objects) {
+    long sizes, rtti;
+    double tag = nsPerCheck(objects,
+            [](Object* object) { return object->as<T>()->size(); }, sizes);
+    double cast = nsPerCheck(objects, [](Object* object) {
+        T* value = dynamic_cast<T*>(object);
+        if (!value)
+            throw TypeError(object->repr() + " is not a " + T::typeRpr());
+        return value->size();
+    }, rtti);
+    std::printf("%-16s %8.2f %8.2f%s\n", what, tag, cast, sizes == rtti ? "" : "  MISMATCH");
+}
+
+int main() {
+    // Mixed heap objects in a random order, so neither way can predict
+    // the answer
+    std::vector<ObPtr> pool;
+    for (int i = 0; i < 256; i++) {
+        pool.push_back(newRational(i, 7));
+        pool.push_back(newSymbol("sym"));
+        pool.push_back(newList(pool.cend() - 2, pool.cend()));
+        pool.push_back(newVector(pool.cend() - 3, pool.cend()));
+    }
+    std::shuffle(pool.begin(), pool.end(), std::mt19937(1));
+    std::vector<Object*> objects, sequences;
+    for (const ObPtr& value : pool) {
+        objects.push_back(value.get());
+        if (value.is<Sequence>())
+            sequences.push_back(value.get());
+    }
+
+    std::printf("%-16s %8s %8s\n", "ns per check", "tag", "rtti");
+    compare<Numeric>("is<Numeric>", objects);
+    compare<Sequence>("is<Sequence>", objects);
+    compare<Rational>("is<Rational>", objects);
+    compare<Symbol>("is<Symbol>", objects);
+    compareAs<Sequence>("as<Sequence>", sequences);
+    return 0;
+}
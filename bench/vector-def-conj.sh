@@ -0,0 +1,7 @@
+#!/bin/bash
+# Rebinds a global vector with one more element, 20000 times
+echo '(def! v [])'
+for ((i = 0; i < 20000; i++)); do
+    echo "(def! v (conj v $i))"
+done
+echo '(prn (count v))'
@@ -0,0 +1,39 @@
+#ifndef _ALIGNED_H_
+#define _ALIGNED_H_
+
+#include <cstddef>
+#include <new>
+
+
+// Byte alignment of numeric buffers: one cache line, which also covers
+// every SIMD register width in use.
+const static std::size_t BUFFER_ALIGNMENT = 64;
+
+
+template<typename T, std::size_t Align = BUFFER_ALIGNMENT>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+    AlignedAllocator() { };
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) { };
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T* ptr, std::size_t) {
+        ::operator delete(ptr, std::align_val_t(Align));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <new>
+
+#include "arena.h"
+
+
+// Blocks start small, since most forms are a line or two, and double up
+// to MAX_BLOCK for large data
+const static std::size_t FIRST_BLOCK = 4096;
+const static std::size_t MAX_BLOCK = 4 << 20;
+
+
+Arena::Arena(Block* first, char* cur, char* end, std::size_t nextSize)
+    : blocks_(first), cur_(cur), end_(end), nextSize_(nextSize),
+      live_(0), sealed_(false) { }
+
+Arena* Arena::create() {
+    char* mem = static_cast<char*>(::operator new(FIRST_BLOCK));
+    Block* first = new (mem) Block { nullptr };
+    char* at = alignUp(mem + sizeof(Block), alignof(Arena));
+    return new (at) Arena(first, at + sizeof(Arena), mem + FIRST_BLOCK,
+                          2 * FIRST_BLOCK);
+}
+
+void Arena::grow(std::size_t size, std::size_t align) {
+    std::size_t blockSize = std::max(nextSize_, sizeof(Block) + size + align);
+    nextSize_ = std::min(2 * nextSize_, MAX_BLOCK);
+    char* mem = static_cast<char*>(::operator new(blockSize));
+    blocks_ = new (mem) Block { blocks_ };
+    cur_ = mem + sizeof(Block);
+    end_ = mem + blockSize;
+}
+
+// The first block, which holds the arena itself, is last in the list
+void Arena::destroy() {
+    Block* block = blocks_;
+    this->~Arena();
+    while (block) {
+        Block* next = block->next;
+        ::operator delete(block);
+        block = next;
+    }
+}
+
+
+void arenaDestroy(const Object* node) {
+    auto header = static_cast<Arena* const*>(dynamic_cast<const void*>(node));
+    Arena* arena = header[-1];
+    node->~Object();
+    arena->release();
+}
+
+
+bool reachesArena(const ObPtr& value) {
+    if (!value.isObject())
+        return false;
+    if (value->inArena())
+        return true;
+    if (value->detached())
+        return false;
+    if (value.is<Sequence>()) {
+        for (auto& e : *value->as<Sequence>())
+            if (reachesArena(e))
+                return true;
+    } else if (value.is<HashMap>()) {
+        for (auto& entry : *value->as<HashMap>())
+            if (reachesArena(entry.key) || reachesArena(entry.value))
+                return true;
+    } else {
+        return false;
+    }
+    value->markDetached();
+    return false;
+}
+
+ObPtr promote(const ObPtr& value) {
+    if (!reachesArena(value))
+        return value;
+    switch (value->tag()) {
+        case TypeTag::Integer:
+            return newInteger(value->as<Integer>()->value());
+        case TypeTag::Rational: {
+            const Rational* r = value->as<Rational>();
+            if (r->isBig())
+                return newRational(r->bigNumer(), r->bigDenom());
+            return newRational(r->numer(), r->denom());
+        }
+        case TypeTag::BigInteger:
+            return newInteger(value->as<BigInteger>()->value());
+        case TypeTag::List:
+        case TypeTag::Vector: {
+            std::vector<ObPtr> items;
+            items.reserve(value->as<Sequence>()->size());
+            for (auto& e : *value->as<Sequence>())
+                items.push_back(promote(e));
+            if (value->is<List>())
+                return newList(items.cbegin(), items.cend());
+            return newVector(items.cbegin(), items.cend());
+        }
+        case TypeTag::HashMap: {
+            ObPtr map = newHashMap();
+            for (auto& entry : *value->as<HashMap>())
+                map->as<HashMap>()->set(promote(entry.key), promote(entry.value));
+            return map;
+        }
+        default:
+            return value;
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#include "types.h"
+
+
+// Bump allocator for the nodes the reader builds for one top-level form.
+// Nodes are never freed one by one: the blocks go back to the heap
+// together once the arena is sealed (the form has been read) and every
+// node allocated from it has been destroyed. A node that escapes
+// therefore stays valid, it only keeps its blocks alive.
+class Arena {
+    struct Block {
+        Block* next;
+    };
+
+    Block* blocks_;
+    char* cur_;
+    char* end_;
+    std::size_t nextSize_;
+    std::size_t live_;
+    bool sealed_;
+
+    Arena(Block* first, char* cur, char* end, std::size_t nextSize);
+    void grow(std::size_t size, std::size_t align);
+    void destroy();
+public:
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // The arena lives at the start of its own first block
+    static Arena* create();
+
+    void* allocate(std::size_t size, std::size_t align) {
+        char* ptr = alignUp(cur_, align);
+        if (ptr + size > end_) {
+            grow(size, align);
+            ptr = alignUp(cur_, align);
+        }
+        cur_ = ptr + size;
+        live_++;
+        return ptr;
+    }
+
+    void release() {
+        if (--live_ == 0 && sealed_)
+            destroy();
+    }
+
+    // No more allocations will be made
+    void seal() {
+        sealed_ = true;
+        if (live_ == 0)
+            destroy();
+    }
+
+private:
+    static char* alignUp(char* ptr, std::size_t align) {
+        auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+        return reinterpret_cast<char*>((addr + align - 1) & ~(align - 1));
+    }
+};
+
+
+// A T in arena, or on the heap when there is no arena. Each arena node
+// is preceded by a pointer to its arena, for arenaDestroy().
+template<typename T, typename... Args>
+ObPtr arenaNew(Arena* arena, Args&&... args) {
+    static_assert(alignof(T) <= alignof(Arena*), "over-aligned node");
+    if (!arena)
+        return ObPtr(new T(std::forward<Args>(args)...));
+    Arena** header = static_cast<Arena**>(
+        arena->allocate(sizeof(Arena*) + sizeof(T), alignof(Arena*)));
+    *header = arena;
+    T* node;
+    try {
+        node = new (header + 1) T(std::forward<Args>(args)...);
+    } catch (...) {
+        arena->release();
+        throw;
+    }
+    node->markInArena();
+    return ObPtr(node);
+}
+
+// Destroys a node made by arenaNew and gives its space back
+void arenaDestroy(const Object* node);
+
+// Whether value or anything it holds lives in an arena
+bool reachesArena(const ObPtr& value);
+
+// value, with every part of it that lives in an arena copied to the heap,
+// so that storing it does not keep a form's arena alive
+ObPtr promote(const ObPtr& value);
+
+#endif
@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "bigint.h"
+
+
+typedef BigInt::Limb Limb;
+typedef BigInt::Limbs Limbs;
+typedef unsigned __int128 Wide;
+
+// Below this many limbs in the shorter operand schoolbook multiplication
+// beats Karatsuba's extra additions
+const static std::size_t KARATSUBA_THRESHOLD = 48;
+
+// The largest power of ten in a limb, for converting 19 digits at a time
+const static Limb DECIMAL_BASE = 10000000000000000000ULL;
+const static int DECIMAL_DIGITS = 19;
+
+
+// Magnitudes
+
+static void trim(Limbs& a) {
+    while (!a.empty() && a.back() == 0)
+        a.pop_back();
+}
+
+static int compareMagnitudes(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size())
+        return a.size() < b.size() ? -1 : 1;
+    for (std::size_t i = a.size(); i-- > 0;)
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+static Limbs addMagnitudes(const Limbs& a, const Limbs& b) {
+    const Limbs& longer = a.size() >= b.size() ? a : b;
+    const Limbs& shorter = a.size() >= b.size() ? b : a;
+    Limbs res(longer.size() + 1);
+    Limb carry = 0;
+    for (std::size_t i = 0; i < longer.size(); i++) {
+        Wide sum = Wide(longer[i]) + (i < shorter.size() ? shorter[i] : 0) + carry;
+        res[i] = Limb(sum);
+        carry = Limb(sum >> 64);
+    }
+    res[longer.size()] = carry;
+    trim(res);
+    return res;
+}
+
+// a - b for a >= b
+static Limbs subtractMagnitudes(const Limbs& a, const Limbs& b) {
+    Limbs res(a.size());
+    Limb borrow = 0;
+    for (std::size_t i = 0; i < a.size(); i++) {
+        Limb r = i < b.size() ? b[i] : 0;
+        Limb diff = a[i] - r - borrow;
+        borrow = (a[i] < r) || (a[i] - r < borrow);
+        res[i] = diff;
+    }
+    trim(res);
+    return res;
+}
+
+// a += b << (64 * shift), with a long enough to hold the result
+static void addShifted(Limbs& a, const Limbs& b, std::size_t shift) {
+    Limb carry = 0;
+    std::size_t i = 0;
+    for (; i < b.size(); i++) {
+        Wide sum = Wide(a[i + shift]) + b[i] + carry;
+        a[i + shift] = Limb(sum);
+        carry = Limb(sum >> 64);
+    }
+    for (i += shift; carry; i++) {
+        Wide sum = Wide(a[i]) + carry;
+        a[i] = Limb(sum);
+        carry = Limb(sum >> 64);
+    }
+}
+
+static Limbs slice(const Limbs& a, std::size_t from, std::size_t to) {
+    from = std::min(from, a.size());
+    to = std::min(to, a.size());
+    Limbs res(a.begin() + from, a.begin() + to);
+    trim(res);
+    return res;
+}
+
+static Limbs schoolbookMultiply(const Limbs& a, const Limbs& b) {
+    Limbs res(a.size() + b.size());
+    for (std::size_t i = 0; i < a.size(); i++) {
+        Limb carry = 0;
+        for (std::size_t j = 0; j < b.size(); j++) {
+            Wide prod = Wide(a[i]) * b[j] + res[i + j] + carry;
+            res[i + j] = Limb(prod);
+            carry = Limb(prod >> 64);
+        }
+        res[i + b.size()] = carry;
+    }
+    trim(res);
+    return res;
+}
+
+// Karatsuba: with a = a1 B + a0 and b = b1 B + b0, a b is
+// z2 B^2 + z1 B + z0 where z1 = (a0 + a1)(b0 + b1) - z2 - z0, three
+// half-size products instead of four
+static Limbs multiplyMagnitudes(const Limbs& a, const Limbs& b) {
+    if (a.empty() || b.empty())
+        return Limbs();
+    if (std::min(a.size(), b.size()) < KARATSUBA_THRESHOLD)
+        return schoolbookMultiply(a, b);
+
+    std::size_t half = std::max(a.size(), b.size()) / 2;
+    Limbs a0 = slice(a, 0, half), a1 = slice(a, half, a.size());
+    Limbs b0 = slice(b, 0, half), b1 = slice(b, half, b.size());
+    Limbs res(a.size() + b.size() + 1);
+    if (a1.empty() || b1.empty()) {
+        // One operand fits in the low half: two products instead
+        const Limbs& whole = a1.empty() ? a : b;
+        const Limbs& lo = a1.empty() ? b0 : a0;
+        const Limbs& hi = a1.empty() ? b1 : a1;
+        addShifted(res, multiplyMagnitudes(whole, lo), 0);
+        addShifted(res, multiplyMagnitudes(whole, hi), half);
+        trim(res);
+        return res;
+    }
+    Limbs z0 = multiplyMagnitudes(a0, b0);
+    Limbs z2 = multiplyMagnitudes(a1, b1);
+    Limbs z1 = multiplyMagnitudes(addMagnitudes(a0, a1), addMagnitudes(b0, b1));
+    z1 = subtractMagnitudes(subtractMagnitudes(z1, z0), z2);
+    addShifted(res, z0, 0);
+    addShifted(res, z1, half);
+    addShifted(res, z2, 2 * half);
+    trim(res);
+    return res;
+}
+
+// a /= d, returning the remainder
+static Limb divideBySmall(Limbs& a, Limb d) {
+    Wide rem = 0;
+    for (std::size_t i = a.size(); i-- > 0;) {
+        Wide cur = (rem << 64) | a[i];
+        a[i] = Limb(cur / d);
+        rem = cur % d;
+    }
+    trim(a);
+    return Limb(rem);
+}
+
+// a = a * m + add
+static void multiplyAddSmall(Limbs& a, Limb m, Limb add) {
+    Limb carry = add;
+    for (auto& limb : a) {
+        Wide prod = Wide(limb) * m + carry;
+        limb = Limb(prod);
+        carry = Limb(prod >> 64);
+    }
+    if (carry)
+        a.push_back(carry);
+}
+
+static Limbs shiftLeftBits(const Limbs& a, int bits, std::size_t extra) {
+    Limbs res(a.size() + extra);
+    for (std::size_t i = 0; i < a.size(); i++) {
+        res[i] |= a[i] << bits;
+        if (bits && i + 1 < res.size())
+            res[i + 1] = a[i] >> (64 - bits);
+    }
+    return res;
+}
+
+// Knuth's algorithm D (TAOCP 4.3.1): one quotient limb per step,
+// estimated from the top two limbs of the remainder and the top limb of
+// the divisor, which is normalised so that the estimate is at most two
+// too large.
+static void divideMagnitudes(const Limbs& u, const Limbs& v, Limbs& q, Limbs& r) {
+    if (compareMagnitudes(u, v) < 0) {
+        q.clear();
+        r = u;
+        return;
+    }
+    if (v.size() == 1) {
+        q = u;
+        Limb rem = divideBySmall(q, v[0]);
+        r = rem ? Limbs { rem } : Limbs();
+        return;
+    }
+
+    std::size_t n = v.size();
+    std::size_t m = u.size() - n;
+    int shift = __builtin_clzll(v.back());
+    Limbs vn = shiftLeftBits(v, shift, 0);
+    Limbs un = shiftLeftBits(u, shift, 1);
+    q.assign(m + 1, 0);
+
+    for (std::size_t j = m + 1; j-- > 0;) {
+        Wide top = (Wide(un[j + n]) << 64) | un[j + n - 1];
+        Wide qhat = top / vn[n - 1];
+        Wide rhat = top % vn[n - 1];
+        while (qhat >> 64 ||
+               qhat * vn[n - 2] > ((rhat << 64) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >> 64)
+                break;
+        }
+
+        // un[j..j+n] -= qhat * vn
+        __int128 borrow = 0;
+        __int128 t;
+        for (std::size_t i = 0; i < n; i++) {
+            Wide prod = qhat * vn[i];
+            t = __int128(un[i + j]) - borrow - __int128(Limb(prod));
+            un[i + j] = Limb(t);
+            borrow = __int128(prod >> 64) - (t >> 64);
+        }
+        t = __int128(un[j + n]) - borrow;
+        un[j + n] = Limb(t);
+
+        q[j] = Limb(qhat);
+        if (t < 0) {
+            // qhat was one too large: add vn back
+            q[j]--;
+            Limb carry = 0;
+            for (std::size_t i = 0; i < n; i++) {
+                Wide sum = Wide(un[i + j]) + vn[i] + carry;
+                un[i + j] = Limb(sum);
+                carry = Limb(sum >> 64);
+            }
+            un[j + n] += carry;
+        }
+    }
+    trim(q);
+
+    r.assign(n, 0);
+    for (std::size_t i = 0; i < n; i++) {
+        r[i] = un[i] >> shift;
+        if (shift)
+            r[i] |= un[i + 1] << (64 - shift);
+    }
+    trim(r);
+}
+
+
+// BigInt
+
+BigInt::BigInt(Limbs limbs, bool negative)
+    : limbs_(std::move(limbs)), negative_(negative) {
+    trim(limbs_);
+    if (limbs_.empty())
+        negative_ = false;
+}
+
+BigInt::BigInt(long long val) : negative_(val < 0) {
+    // Negated as unsigned, which also covers LLONG_MIN
+    Limb mag = negative_ ? Limb(0) - Limb(val) : Limb(val);
+    if (mag)
+        limbs_.push_back(mag);
+}
+
+BigInt BigInt::parse(std::string_view digits) {
+    bool negative = false;
+    if (!digits.empty() && (digits[0] == '-' || digits[0] == '+')) {
+        negative = digits[0] == '-';
+        digits.remove_prefix(1);
+    }
+    Limbs limbs;
+    // The first chunk takes the odd digits, the rest are full
+    std::size_t len = digits.size() % DECIMAL_DIGITS;
+    if (len == 0)
+        len = DECIMAL_DIGITS;
+    for (std::size_t pos = 0; pos < digits.size(); pos += len, len = DECIMAL_DIGITS) {
+        Limb chunk = 0;
+        Limb scale = 1;
+        for (std::size_t i = pos; i < pos + len; i++) {
+            chunk = chunk * 10 + Limb(digits[i] - '0');
+            scale *= 10;
+        }
+        multiplyAddSmall(limbs, scale, chunk);
+    }
+    return BigInt(std::move(limbs), negative);
+}
+
+bool BigInt::fitsLongLong() const {
+    if (limbs_.size() > 1)
+        return false;
+    if (limbs_.empty())
+        return true;
+    Limb limit = Limb(1) << 63;
+    return negative_ ? limbs_[0] <= limit : limbs_[0] < limit;
+}
+
+long long BigInt::toLongLong() const {
+    if (limbs_.empty())
+        return 0;
+    return negative_ ? (long long)(Limb(0) - limbs_[0]) : (long long)limbs_[0];
+}
+
+double BigInt::toDouble() const {
+    // The top three limbs hold more bits than a double keeps
+    double res = 0;
+    std::size_t used = std::min<std::size_t>(limbs_.size(), 3);
+    for (std::size_t i = 0; i < used; i++)
+        res = res * 18446744073709551616.0 + double(limbs_[limbs_.size() - 1 - i]);
+    res = std::ldexp(res, int(64 * (limbs_.size() - used)));
+    return negative_ ? -res : res;
+}
+
+// Digits of a, which is below powers[level], padded with zeros to all
+// 19 * 2^level of them if pad is set. powers[k] is 10^(19 * 2^k).
+static void appendDigits(const Limbs& a, const std::vector<Limbs>& powers,
+                         std::size_t level, bool pad, std::string& out) {
+    if (level == 0) {
+        std::string chunk = std::to_string(a.empty() ? 0 : a[0]);
+        if (pad)
+            out.append(DECIMAL_DIGITS - chunk.size(), '0');
+        out += chunk;
+        return;
+    }
+    Limbs q, r;
+    divideMagnitudes(a, powers[level - 1], q, r);
+    if (pad || !q.empty())
+        appendDigits(q, powers, level - 1, pad, out);
+    appendDigits(r, powers, level - 1, pad || !q.empty(), out);
+}
+
+// Splitting in halves by powers of ten, rather than taking 19 digits
+// off the bottom at a time, makes most of the work a few divisions of
+// long numbers by long numbers instead of one pass over the number per
+// chunk of digits
+std::string BigInt::toString() const {
+    if (limbs_.empty())
+        return "0";
+    std::vector<Limbs> powers { Limbs { DECIMAL_BASE } };
+    while (compareMagnitudes(powers.back(), limbs_) <= 0)
+        powers.push_back(multiplyMagnitudes(powers.back(), powers.back()));
+
+    std::string res = negative_ ? "-" : "";
+    appendDigits(limbs_, powers, powers.size() - 1, false, res);
+    return res;
+}
+
+std::size_t BigInt::hash() const {
+    std::size_t seed = negative_;
+    for (Limb limb : limbs_)
+        seed ^= std::hash<Limb> {}(limb) + 0x9e3779b97f4a7c15ULL +
+                (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+BigInt BigInt::operator-() const {
+    return BigInt(limbs_, !negative_);
+}
+
+BigInt operator+(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.negative_ == rhs.negative_)
+        return BigInt(addMagnitudes(lhs.limbs_, rhs.limbs_), lhs.negative_);
+    int cmp = compareMagnitudes(lhs.limbs_, rhs.limbs_);
+    if (cmp >= 0)
+        return BigInt(subtractMagnitudes(lhs.limbs_, rhs.limbs_), lhs.negative_);
+    return BigInt(subtractMagnitudes(rhs.limbs_, lhs.limbs_), rhs.negative_);
+}
+
+BigInt operator-(const BigInt& lhs, const BigInt& rhs) {
+    return lhs + -rhs;
+}
+
+BigInt operator*(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt(multiplyMagnitudes(lhs.limbs_, rhs.limbs_),
+                  lhs.negative_ != rhs.negative_);
+}
+
+void BigInt::divMod(const BigInt& lhs, const BigInt& rhs,
+                    BigInt& quot, BigInt& rem) {
+    Limbs q, r;
+    divideMagnitudes(lhs.limbs_, rhs.limbs_, q, r);
+    quot = BigInt(std::move(q), lhs.negative_ != rhs.negative_);
+    rem = BigInt(std::move(r), lhs.negative_);
+}
+
+BigInt operator/(const BigInt& lhs, const BigInt& rhs) {
+    BigInt quot, rem;
+    BigInt::divMod(lhs, rhs, quot, rem);
+    return quot;
+}
+
+BigInt operator%(const BigInt& lhs, const BigInt& rhs) {
+    BigInt quot, rem;
+    BigInt::divMod(lhs, rhs, quot, rem);
+    return rem;
+}
+
+int compare(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.negative_ != rhs.negative_)
+        return lhs.negative_ ? -1 : 1;
+    int cmp = compareMagnitudes(lhs.limbs_, rhs.limbs_);
+    return lhs.negative_ ? -cmp : cmp;
+}
+
+double BigInt::ratio(const BigInt& num, const BigInt& den) {
+    // Scale num by a power of 2^64 so that the quotient has two or three
+    // limbs, more bits than a double keeps, and scale the result back
+    long shift = long(den.limbs_.size()) + 2 - long(num.limbs_.size());
+    Limbs scaled = shift > 0 ? Limbs(std::size_t(shift), 0) : Limbs();
+    scaled.insert(scaled.end(), num.limbs_.begin() + (shift < 0 ? -shift : 0),
+                  num.limbs_.end());
+    trim(scaled);
+    Limbs q, r;
+    divideMagnitudes(scaled, den.limbs_, q, r);
+    double res = std::ldexp(BigInt(std::move(q), false).toDouble(), int(-64 * shift));
+    return num.negative_ != den.negative_ ? -res : res;
+}
+
+static std::size_t trailingZeroBits(const Limbs& a) {
+    std::size_t i = 0;
+    while (a[i] == 0)
+        i++;
+    return 64 * i + __builtin_ctzll(a[i]);
+}
+
+// a >>= bits, in place
+static void shiftRight(Limbs& a, std::size_t bits) {
+    std::size_t limbs = bits / 64;
+    int rest = bits % 64;
+    std::size_t size = a.size() - limbs;
+    for (std::size_t i = 0; i < size; i++) {
+        a[i] = a[i + limbs] >> rest;
+        if (rest && i + limbs + 1 < a.size())
+            a[i] |= a[i + limbs + 1] << (64 - rest);
+    }
+    a.resize(size);
+    trim(a);
+}
+
+// a -= b for a >= b, in place
+static void subtractFrom(Limbs& a, const Limbs& b) {
+    Limb borrow = 0;
+    for (std::size_t i = 0; i < a.size() && (i < b.size() || borrow); i++) {
+        Limb r = i < b.size() ? b[i] : 0;
+        Limb diff = a[i] - r - borrow;
+        borrow = (a[i] < r) || (a[i] - r < borrow);
+        a[i] = diff;
+    }
+    trim(a);
+}
+
+// Euclid's algorithm while the operands differ in length, where one
+// division takes off whole limbs; then Stein's binary algorithm, which
+// works in place with shifts and subtractions.
+BigInt BigInt::gcd(BigInt a, BigInt b) {
+    Limbs& u = a.limbs_;
+    Limbs& v = b.limbs_;
+    while (!v.empty() && u.size() != v.size()) {
+        Limbs q, r;
+        divideMagnitudes(u, v, q, r);
+        u.swap(v);
+        v.swap(r);
+    }
+    if (v.empty())
+        return BigInt(std::move(u), false);
+
+    std::size_t uZeros = trailingZeroBits(u);
+    std::size_t vZeros = trailingZeroBits(v);
+    std::size_t shift = std::min(uZeros, vZeros);
+    shiftRight(u, uZeros);
+    do {
+        shiftRight(v, trailingZeroBits(v));
+        if (compareMagnitudes(u, v) > 0)
+            u.swap(v);
+        subtractFrom(v, u);
+    } while (!v.empty());
+
+    Limbs res = shiftLeftBits(u, int(shift % 64), 1);
+    res.insert(res.begin(), shift / 64, 0);
+    return BigInt(std::move(res), false);
+}
@@ -0,0 +1,70 @@
+#ifndef _BIGINT_H_
+#define _BIGINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Arbitrary-precision integer: a sign and a magnitude in 64-bit limbs,
+// least significant first, without leading zero limbs (zero has none).
+class BigInt {
+public:
+    typedef std::uint64_t Limb;
+    typedef std::vector<Limb> Limbs;
+
+private:
+    Limbs limbs_;
+    bool negative_;
+
+    BigInt(Limbs limbs, bool negative);
+public:
+    BigInt() : negative_(false) { };
+    explicit BigInt(long long val);
+
+    // [+-]digits; the caller has checked the syntax
+    static BigInt parse(std::string_view digits);
+
+    bool isZero() const { return limbs_.empty(); }
+    bool isNegative() const { return negative_; }
+    bool fitsLongLong() const;
+    // Only for values that fit
+    long long toLongLong() const;
+    double toDouble() const;
+    std::string toString() const;
+    std::size_t hash() const;
+
+    BigInt operator-() const;
+    friend BigInt operator+(const BigInt& lhs, const BigInt& rhs);
+    friend BigInt operator-(const BigInt& lhs, const BigInt& rhs);
+    friend BigInt operator*(const BigInt& lhs, const BigInt& rhs);
+    // Truncating, like long long; the divisor must not be zero
+    friend BigInt operator/(const BigInt& lhs, const BigInt& rhs);
+    friend BigInt operator%(const BigInt& lhs, const BigInt& rhs);
+    static void divMod(const BigInt& lhs, const BigInt& rhs,
+                       BigInt& quot, BigInt& rem);
+
+    // Negative, zero or positive as lhs is less than, equal to or
+    // greater than rhs
+    friend int compare(const BigInt& lhs, const BigInt& rhs);
+    friend bool operator==(const BigInt& lhs, const BigInt& rhs) {
+        return compare(lhs, rhs) == 0;
+    }
+    friend bool operator!=(const BigInt& lhs, const BigInt& rhs) {
+        return compare(lhs, rhs) != 0;
+    }
+    friend bool operator<(const BigInt& lhs, const BigInt& rhs) {
+        return compare(lhs, rhs) < 0;
+    }
+
+    // num / den to double precision, also where num and den themselves
+    // are too large for a double; den must not be zero
+    static double ratio(const BigInt& num, const BigInt& den);
+
+    // Non-negative greatest common divisor
+    static BigInt gcd(BigInt a, BigInt b);
+};
+
+#endif
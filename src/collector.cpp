@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "collector.h"
+#include "environment.h"
+#include "pmap.h"
+#include "pvector.h"
+#include "types.h"
+#include "vm.h"
+
+
+Collectable* Collectable::first_ = nullptr;
+std::size_t Collectable::created_ = 0;
+// Frames made before the first run, and the fewest between two runs.
+// Lower, code without cycles pays for a run every few calls; higher,
+// more garbage piles up and each run walks past all of it.
+std::size_t Collectable::budget_ = 1024;
+
+// Collects before this frame joins the list: it is not built yet
+void Collectable::link() {
+    if (++created_ > budget_)
+        collectCycles();
+    prev_ = nullptr;
+    next_ = first_;
+    if (first_)
+        first_->prev_ = this;
+    first_ = this;
+}
+
+Collectable::~Collectable() {
+    if (prev_)
+        prev_->next_ = next_;
+    else
+        first_ = next_;
+    if (next_)
+        next_->prev_ = prev_;
+}
+
+
+// The reference graph: frames, the values that can lead back to a frame,
+// and the trie nodes of vectors and maps, which are counted on their own.
+// Other values hold no frames and are left out.
+
+enum class Kind { Frame, Object, VectorNode, MapNode };
+
+typedef std::pair<const void*, Kind> Vertex;
+
+struct VertexInfo {
+    Vertex vertex;
+    // References in all, and those from vertices of the graph
+    long refs;
+    long inner;
+    // Its targets in Graph::targets
+    std::size_t begin, end;
+    bool live;
+};
+
+// Vertex ids by address: open addressing, as the graph is built anew
+// for every run and each vertex is looked up once per reference to it
+class VertexIds {
+    std::vector<std::pair<const void*, std::size_t>> slots_;
+    std::size_t size_ = 0;
+
+    std::size_t slotOf(const void* ptr) const {
+        std::size_t mask = slots_.size() - 1;
+        std::size_t i = (std::uintptr_t(ptr) >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & mask;
+        while (slots_[i].first && slots_[i].first != ptr)
+            i = (i + 1) & mask;
+        return i;
+    }
+public:
+    explicit VertexIds(std::size_t expected) {
+        std::size_t size = 16;
+        while (size < 2 * expected)
+            size *= 2;
+        slots_.resize(size);
+    }
+
+    // The id of ptr, which becomes next if ptr is new
+    std::pair<std::size_t, bool> emplace(const void* ptr, std::size_t next) {
+        if (2 * (size_ + 1) > slots_.size()) {
+            std::vector<std::pair<const void*, std::size_t>> old(2 * slots_.size());
+            old.swap(slots_);
+            for (const auto& slot : old)
+                if (slot.first)
+                    slots_[slotOf(slot.first)] = slot;
+        }
+        std::size_t i = slotOf(ptr);
+        if (slots_[i].first)
+            return { slots_[i].second, false };
+        slots_[i] = { ptr, next };
+        size_++;
+        return { next, true };
+    }
+};
+
+struct Graph {
+    VertexIds ids;
+    std::vector<VertexInfo> vertices;
+    std::vector<std::size_t> targets;
+    // Scratch space for edges()
+    std::vector<Vertex> out;
+    std::vector<const ObPtr*> values;
+    std::vector<const Collectable*> frames;
+};
+
+static void valueEdge(const ObPtr& value, std::vector<Vertex>& out) {
+    if (!value.isObject() || value->inArena())
+        return;
+    switch (value.tag()) {
+        case TypeTag::List:
+        case TypeTag::Vector:
+        case TypeTag::HashMap:
+        case TypeTag::Closure:
+        case TypeTag::CompiledFn:
+            out.emplace_back(value.get(), Kind::Object);
+            break;
+        default:
+            break;
+    }
+}
+
+static void frameEdge(const Collectable* frame, std::vector<Vertex>& out) {
+    if (frame)
+        out.emplace_back(frame, Kind::Frame);
+}
+
+// Fills graph.out with the vertices vertex refers to
+static void edges(const Vertex& vertex, Graph& graph) {
+    std::vector<Vertex>& out = graph.out;
+    out.clear();
+    switch (vertex.second) {
+        case Kind::Frame: {
+            graph.values.clear();
+            graph.frames.clear();
+            static_cast<const Collectable*>(vertex.first)->references(graph.values,
+                                                                       graph.frames);
+            for (const ObPtr* value : graph.values)
+                valueEdge(*value, out);
+            for (const Collectable* frame : graph.frames)
+                frameEdge(frame, out);
+            break;
+        }
+        case Kind::Object: {
+            const Object* object = static_cast<const Object*>(vertex.first);
+            switch (object->tag()) {
+                case TypeTag::List:
+                    for (const ObPtr& item : *object->as<List>())
+                        valueEdge(item, out);
+                    break;
+                case TypeTag::Vector: {
+                    const PersistentVector& items = object->as<Vector>()->items();
+                    const PersistentVector::Node* root = items.root();
+                    const PersistentVector::Node* tail = items.tail();
+                    if (root)
+                        out.emplace_back(root, Kind::VectorNode);
+                    if (tail)
+                        out.emplace_back(tail, Kind::VectorNode);
+                    break;
+                }
+                case TypeTag::HashMap:
+                    if (object->as<HashMap>()->items().root())
+                        out.emplace_back(object->as<HashMap>()->items().root(),
+                                         Kind::MapNode);
+                    break;
+                case TypeTag::Closure:
+                    frameEdge(object->as<Closure>()->env().get(), out);
+                    break;
+                case TypeTag::CompiledFn:
+                    frameEdge(object->as<CompiledFn>()->frame().get(), out);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case Kind::VectorNode: {
+            const PersistentVector::Node* node =
+                static_cast<const PersistentVector::Node*>(vertex.first);
+            if (node->leaf) {
+                // Slots past filled still hold their values
+                for (const ObPtr& value : static_cast<const PersistentVector::Leaf*>(node)->values)
+                    valueEdge(value, out);
+            } else {
+                for (const PersistentVector::Node* child :
+                        static_cast<const PersistentVector::Branch*>(node)->children)
+                    if (child)
+                        out.emplace_back(child, Kind::VectorNode);
+            }
+            break;
+        }
+        case Kind::MapNode: {
+            const PersistentMap::Node* node =
+                static_cast<const PersistentMap::Node*>(vertex.first);
+            for (const PersistentMap::Entry& entry : node->entries) {
+                valueEdge(entry.key, out);
+                valueEdge(entry.value, out);
+            }
+            for (const PersistentMap::Node* child : node->children)
+                out.emplace_back(child, Kind::MapNode);
+            break;
+        }
+    }
+}
+
+static long refCount(const Vertex& vertex) {
+    switch (vertex.second) {
+        case Kind::Frame: {
+            long refs = static_cast<const Collectable*>(vertex.first)->weak_from_this().use_count();
+            // A frame no shared_ptr owns yet is not ours to free
+            return refs ? refs : 1;
+        }
+        case Kind::Object:
+            return static_cast<const Object*>(vertex.first)->refCount();
+        case Kind::VectorNode:
+            return static_cast<const PersistentVector::Node*>(vertex.first)->refs;
+        case Kind::MapNode:
+            return static_cast<const PersistentMap::Node*>(vertex.first)->refs;
+    }
+    return 1;
+}
+
+static std::size_t visit(Graph& graph, const Vertex& vertex) {
+    auto found = graph.ids.emplace(vertex.first, graph.vertices.size());
+    if (found.second)
+        graph.vertices.push_back(VertexInfo { vertex, refCount(vertex), 0, 0, 0, false });
+    return found.first;
+}
+
+// Trial deletion: count the references each vertex gets from inside the
+// graph. A vertex with more references than that is held from outside,
+// by a variable, the stack or a global, and so is everything it leads
+// to. The frames left over are only held by each other.
+void collectCycles() {
+    Graph graph { VertexIds(2 * Collectable::budget_) };
+
+    // Frames first, in list order
+    for (Collectable* frame = Collectable::first_; frame; frame = frame->next_)
+        visit(graph, Vertex(frame, Kind::Frame));
+    for (std::size_t i = 0; i < graph.vertices.size(); i++) {
+        edges(graph.vertices[i].vertex, graph);
+        graph.vertices[i].begin = graph.targets.size();
+        for (const Vertex& target : graph.out) {
+            std::size_t j = visit(graph, target);
+            graph.vertices[j].inner++;
+            graph.targets.push_back(j);
+        }
+        graph.vertices[i].end = graph.targets.size();
+    }
+
+    std::vector<std::size_t> pending;
+    for (std::size_t i = 0; i < graph.vertices.size(); i++)
+        if (graph.vertices[i].refs > graph.vertices[i].inner) {
+            graph.vertices[i].live = true;
+            pending.push_back(i);
+        }
+    std::size_t live = pending.size();
+    while (!pending.empty()) {
+        const VertexInfo& info = graph.vertices[pending.back()];
+        pending.pop_back();
+        for (std::size_t k = info.begin; k < info.end; k++) {
+            VertexInfo& target = graph.vertices[graph.targets[k]];
+            if (!target.live) {
+                target.live = true;
+                live++;
+                pending.push_back(graph.targets[k]);
+            }
+        }
+    }
+
+    // Held here, each frame lasts until all of them have let go
+    std::vector<std::shared_ptr<Collectable>> garbage;
+    std::size_t i = 0;
+    for (Collectable* frame = Collectable::first_; frame; frame = frame->next_, i++)
+        if (!graph.vertices[i].live)
+            garbage.push_back(frame->shared_from_this());
+    for (auto& frame : garbage)
+        frame->dropReferences();
+    garbage.clear();
+
+    Collectable::created_ = 0;
+    // What the next run has to look at besides the new frames
+    Collectable::budget_ = std::max<std::size_t>(1024, live);
+}
@@ -0,0 +1,46 @@
+#ifndef _COLLECTOR_H_
+#define _COLLECTOR_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "obptr.h"
+
+
+// Frames (Env, and the VM's Frame) are counted by shared_ptr, values by
+// ObPtr, and a closure holds the frame it was created in. Values do not
+// change once built, so a reference cycle always runs through a frame:
+// a closure bound in the frame it captured, or in one further out. No
+// count in such a cycle drops to zero, so every frame is kept in a list
+// and collectCycles() looks for the ones that only cycles hold.
+class Collectable : public std::enable_shared_from_this<Collectable> {
+    Collectable* prev_;
+    Collectable* next_;
+
+    static Collectable* first_;
+    static std::size_t created_;
+    static std::size_t budget_;
+
+    void link();
+
+    friend void collectCycles();
+public:
+    Collectable() { link(); };
+    Collectable(const Collectable&) : enable_shared_from_this() { link(); };
+    Collectable& operator=(const Collectable&) { return *this; }
+    virtual ~Collectable();
+
+    // The values and frames this frame holds a reference to
+    virtual void references(std::vector<const ObPtr*>& values,
+                            std::vector<const Collectable*>& frames) const = 0;
+    // Lets go of all of them, to break the cycles it is in
+    virtual void dropReferences() = 0;
+};
+
+// Frees the frames that nothing outside their cycles holds, along with
+// what only they held. Also runs by itself, once more frames have been
+// made since the last run than that run found still in use.
+void collectCycles();
+
+#endif
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <utility>
+
+#include "compiler.h"
+#include "exceptions.h"
+#include "repl.h"
+#include "resolver.h"
+
+
+const char* const INTRINSIC_NAMES[] = {
+    "+", "-", "*", "/", "=", "<", "<=", ">", ">=",
+};
+
+
+// Compiles the forms of one function. Locals are resolved to frame slots
+// at compile time; a symbol not bound by an enclosing let* or fn* is a
+// global and is looked up in the Env at run time. As in the tree-walker,
+// a def! inside a let* or fn* binds a slot of that form, and only a def!
+// outside of them binds a global.
+class Compiler {
+    struct Local {
+        const Object* symbol;
+        int slot;
+        // Bound by a def!, which may not have run yet. Until it has, the
+        // name means what it does further out.
+        bool byDef;
+    };
+
+    Compiler* parent_;
+    ProtoPtr proto_;
+    // Bindings in scope, innermost last. Slots are never reused, since a
+    // closure may still read a slot after its let* has finished.
+    std::vector<Local> locals_;
+    // Where the bindings of the innermost let* or fn* start, or -1 for
+    // top-level forms outside of any
+    int scope_;
+
+    void emit(OpCode op, int a = 0, uint16_t b = 0);
+    int here() const { return proto_->code.size(); }
+    void patch(int at) { proto_->code[at].a = here(); }
+    int constant(ObPtr value);
+    int global(ObPtr symbol);
+    int newSlot() { return proto_->slots++; }
+    bool resolve(const Object* symbol, int& depth, int& slot) const;
+    void bindDefs(const ObPtr& ast);
+
+    void compileSymbol(const ObPtr& ast);
+    void compileDef(List* list);
+    void compileLet(List* list, bool tail);
+    void compileDo(List* list, bool tail);
+    void compileIf(List* list, bool tail);
+    void compileFn(List* list);
+    void compileCall(List* list, bool tail);
+public:
+    Compiler(Compiler* parent)
+        : parent_(parent), proto_(new Proto), scope_(parent ? 0 : -1) { };
+    void compile(const ObPtr& ast, bool tail);
+    void bindParams(const ObPtr& params);
+    ProtoPtr finish();
+};
+
+
+void Compiler::emit(OpCode op, int a, uint16_t b) {
+    proto_->code.push_back({ op, b, a });
+}
+
+int Compiler::constant(ObPtr value) {
+    proto_->constants.push_back(value);
+    return proto_->constants.size() - 1;
+}
+
+int Compiler::global(ObPtr symbol) {
+    auto& globals = proto_->globals;
+    for (unsigned i = 0; i < globals.size(); i++)
+        if (globals[i].symbol == symbol)
+            return i;
+    globals.push_back({ symbol, nullptr, 0 });
+    return globals.size() - 1;
+}
+
+bool Compiler::resolve(const Object* symbol, int& depth, int& slot) const {
+    depth = 0;
+    for (const Compiler* c = this; c; c = c->parent_, depth++) {
+        for (auto it = c->locals_.rbegin(); it != c->locals_.rend(); it++) {
+            if (it->symbol == symbol) {
+                slot = it->slot;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Gives the names that def! forms in ast bind in the current scope a
+// slot each, unless the scope already has one
+void Compiler::bindDefs(const ObPtr& ast) {
+    Scope names;
+    collectDefs(ast, names);
+    for (const ObPtr& name : names) {
+        auto it = std::find_if(locals_.begin() + scope_, locals_.end(),
+                [&](const Local& local) { return local.symbol == name.get(); });
+        if (it == locals_.end())
+            locals_.push_back({ name.get(), newSlot(), true });
+    }
+}
+
+void Compiler::compile(const ObPtr& ast, bool tail) {
+    if (ast.is<Symbol>())
+        return compileSymbol(ast);
+    else if (ast.is<Vector>()) {
+        Vector* vector = ast->as<Vector>();
+        for (auto& e : *vector)
+            compile(e, false);
+        emit(OpCode::MakeVector, vector->size());
+        return;
+    } else if (ast.is<HashMap>()) {
+        HashMap* map = ast->as<HashMap>();
+        int size = 0;
+        for (auto& e : *map) {
+            emit(OpCode::Const, constant(e.key));
+            compile(e.value, false);
+            size++;
+        }
+        emit(OpCode::MakeHashMap, size);
+        return;
+    } else if (!ast.is<List>() || ast->as<List>()->empty()) {
+        emit(OpCode::Const, constant(ast));
+        return;
+    }
+
+    List* list = ast->as<List>();
+    ObPtr first = list->at(0);
+    if (first == DEF_SYM)
+        compileDef(list);
+    else if (first == LET_SYM)
+        compileLet(list, tail);
+    else if (first == DO_SYM)
+        compileDo(list, tail);
+    else if (first == IF_SYM)
+        compileIf(list, tail);
+    else if (first == FN_SYM)
+        compileFn(list);
+    else
+        compileCall(list, tail);
+}
+
+// A def! slot is tried first and, while unbound, skipped for the next
+// binding of the name further out
+void Compiler::compileSymbol(const ObPtr& ast) {
+    std::vector<int> toEnd;
+    int depth = 0;
+    for (const Compiler* c = this; c; c = c->parent_, depth++) {
+        for (auto it = c->locals_.rbegin(); it != c->locals_.rend(); it++) {
+            if (it->symbol != ast.get())
+                continue;
+            if (it->byDef) {
+                emit(OpCode::LoadIfBound, it->slot, depth);
+                toEnd.push_back(here());
+                emit(OpCode::Jump);
+                continue;
+            }
+            emit(depth == 0 ? OpCode::LoadLocal : OpCode::LoadOuter, it->slot, depth);
+            for (int at : toEnd)
+                patch(at);
+            return;
+        }
+    }
+    emit(OpCode::LoadGlobal, global(ast));
+    for (int at : toEnd)
+        patch(at);
+}
+
+// def! binds in the innermost let* or fn*, which bindDefs() gave the
+// name a slot, or else in the global environment
+void Compiler::compileDef(List* list) {
+    if (list->size() != 3 || !list->at(1).is<Symbol>())
+        throw SyntaxError(list->repr());
+    compile(list->at(2), false);
+    for (int i = int(locals_.size()) - 1; scope_ >= 0 && i >= scope_; i--) {
+        if (locals_[i].symbol == list->at(1).get()) {
+            emit(OpCode::StoreLocal, locals_[i].slot);
+            emit(OpCode::LoadLocal, locals_[i].slot);
+            return;
+        }
+    }
+    emit(OpCode::DefGlobal, global(list->at(1)));
+}
+
+void Compiler::compileLet(List* list, bool tail) {
+    if (list->size() != 3)
+        throw SyntaxError(list->repr());
+
+    ObPtr bindings(list->at(1));
+    if (bindings->as<Sequence>()->size() % 2 != 0)
+        throw SyntaxError(bindings->repr());
+
+    Sequence* binds = bindings->as<Sequence>();
+    std::size_t scope = locals_.size();
+    int outer = scope_;
+    scope_ = scope;
+    for (int i = 1; i < binds->size(); i += 2)
+        bindDefs(binds->at(i));
+    bindDefs(list->at(2));
+    for (int i = 0; i < binds->size(); i += 2) {
+        ObPtr key = binds->at(i);
+        ObPtr value = binds->at(i + 1);
+        if (!key.is<Symbol>())
+            throw SyntaxError(bindings->repr());
+        int slot = newSlot();
+        // A function may refer to the name it is bound to; any other
+        // value still sees the outer binding of that name.
+        bool isFn = value.is<List>() && !value->as<List>()->empty() &&
+            value->as<List>()->at(0) == FN_SYM;
+        if (isFn)
+            locals_.push_back({ key.get(), slot, false });
+        compile(value, false);
+        emit(OpCode::StoreLocal, slot);
+        if (!isFn)
+            locals_.push_back({ key.get(), slot, false });
+    }
+    compile(list->at(2), tail);
+    locals_.resize(scope);
+    scope_ = outer;
+}
+
+void Compiler::compileDo(List* list, bool tail) {
+    if (list->size() == 1) {
+        emit(OpCode::Const, constant(newNil()));
+        return;
+    }
+    for (int i = 1; i < list->size() - 1; i++) {
+        compile(list->at(i), false);
+        emit(OpCode::Pop);
+    }
+    compile(list->at(list->size() - 1), tail);
+}
+
+void Compiler::compileIf(List* list, bool tail) {
+    if (list->size() != 3 && list->size() != 4)
+        throw SyntaxError("if (condition) (true_expr) [(false_expr)]");
+    compile(list->at(1), false);
+    int toElse = here();
+    emit(OpCode::JumpIfFalse);
+    compile(list->at(2), tail);
+    int toEnd = here();
+    emit(OpCode::Jump);
+    patch(toElse);
+    if (list->size() == 4)
+        compile(list->at(3), tail);
+    else
+        emit(OpCode::Const, constant(newNil()));
+    patch(toEnd);
+}
+
+void Compiler::compileFn(List* list) {
+    if (list->size() != 3)
+        throw SyntaxError("fn* (args) (body)");
+    Compiler fn(this);
+    fn.bindParams(list->at(1));
+    fn.bindDefs(list->at(2));
+    fn.compile(list->at(2), true);
+    proto_->protos.push_back(fn.finish());
+    emit(OpCode::MakeClosure, proto_->protos.size() - 1);
+}
+
+void Compiler::compileCall(List* list, bool tail) {
+    ObPtr first = list->at(0);
+    int argc = list->size() - 1;
+    int depth, slot;
+    if (argc == 2 && first.is<Symbol>() && !resolve(first.get(), depth, slot)) {
+        const std::string& name = first->as<Symbol>()->name();
+        for (unsigned op = 0; op < unsigned(Intrinsic::Count); op++) {
+            if (name == INTRINSIC_NAMES[op]) {
+                compile(list->at(1), false);
+                compile(list->at(2), false);
+                emit(OpCode::BinaryOp, global(first), op);
+                return;
+            }
+        }
+    }
+    for (auto& e : *list)
+        compile(e, false);
+    emit(tail ? OpCode::TailCall : OpCode::Call, argc);
+}
+
+void Compiler::bindParams(const ObPtr& params) {
+    for (auto& e : *params->as<Sequence>()) {
+        if (!e.is<Symbol>())
+            throw SyntaxError(params->repr() + " must be a list of symbols");
+        locals_.push_back({ e.get(), newSlot(), false });
+    }
+    proto_->arity = proto_->slots;
+}
+
+ProtoPtr Compiler::finish() {
+    emit(OpCode::Return);
+    return proto_;
+}
+
+
+ProtoPtr compile(ObPtr ast) {
+    Compiler compiler(nullptr);
+    compiler.compile(ast, false);
+    return compiler.finish();
+}
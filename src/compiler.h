@@ -0,0 +1,81 @@
+#ifndef _COMPILER_H_
+#define _COMPILER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+
+enum class OpCode : uint8_t {
+    Const,          // push constants[a]
+    LoadLocal,      // push slot a of the current frame
+    LoadOuter,      // push slot a of the frame b levels up
+    LoadIfBound,    // LoadOuter if slot a is bound, else skip the next instruction
+    StoreLocal,     // pop into slot a of the current frame
+    LoadGlobal,     // push the value bound to globals[a]
+    DefGlobal,      // bind globals[a] to the top of stack, leave it there
+    Pop,
+    Jump,           // continue at a
+    JumpIfFalse,    // pop, continue at a if the value is falsy
+    MakeClosure,    // push a closure over protos[a] and the current frame
+    MakeVector,     // pop a values, push a Vector of them
+    MakeHashMap,    // pop a key/value pairs, push a HashMap of them
+    Call,           // call the callee below the top a values
+    TailCall,       // Call that reuses the current call record
+    BinaryOp,       // apply globals[a] to 2 values, intrinsic b if unchanged
+    Return,
+};
+
+struct Instruction {
+    OpCode op;
+    uint16_t b;
+    int32_t a;
+};
+
+// Builtins that BinaryOp applies without building an argument vector, as
+// long as their global still holds the function from buildNamespace().
+enum class Intrinsic : uint16_t {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Equal,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Count,
+};
+
+extern const char* const INTRINSIC_NAMES[];
+
+struct GlobalRef {
+    ObPtr symbol;
+    // Binding in the Env, valid while version matches. It points into the
+    // Env rather than owning the value, so that a function referring to
+    // itself does not form a reference cycle through its own code.
+    const ObPtr* value;
+    unsigned version;
+};
+
+// Compiled fn* body, or a top-level form compiled as a function of no
+// arguments. Frames for it hold `slots` values, the first `arity` of
+// which are the parameters.
+struct Proto {
+    std::vector<Instruction> code;
+    std::vector<ObPtr> constants;
+    std::vector<GlobalRef> globals;
+    std::vector<std::shared_ptr<Proto>> protos;
+    int arity = 0;
+    int slots = 0;
+};
+
+typedef std::shared_ptr<Proto> ProtoPtr;
+
+
+ProtoPtr compile(ObPtr ast);
+
+#endif
@@ -8,6 +8,17 @@ HashMap buildNamespace() {
     ns.set(newSymbol("*"), newFn(multiply));
     ns.set(newSymbol("/"), newFn(divide));
     ns.set(newSymbol("**"), newFn(dotProduct));
+    ns.set(newSymbol("add!"), newFn(addInPlace));
+    ns.set(newSymbol("scale!"), newFn(scaleInPlace));
+    ns.set(newSymbol("axpy!"), newFn(axpyInPlace));
+
+    ns.set(newSymbol("sum"), newFn(nvectorSum));
+    ns.set(newSymbol("dot"), newFn(nvectorDot));
+    ns.set(newSymbol("norm"), newFn(nvectorNorm));
+    ns.set(newSymbol("min"), newFn(nvectorMin));
+    ns.set(newSymbol("max"), newFn(nvectorMax));
+    ns.set(newSymbol("argmax"), newFn(nvectorArgmax));
+    ns.set(newSymbol("mean"), newFn(nvectorMean));
 
     ns.set(newSymbol("="), newFn(equal));
     ns.set(newSymbol("!="), newFn(notEqual));
@@ -27,6 +38,14 @@ HashMap buildNamespace() {
     ns.set(newSymbol("list?"), newFn(isList));
     ns.set(newSymbol("empty?"), newFn(isSequenceEmpty));
     ns.set(newSymbol("count"), newFn(seqSize));
+    ns.set(newSymbol("nth"), newFn(nth));
+    ns.set(newSymbol("conj"), newFn(conj));
+    ns.set(newSymbol("assoc"), newFn(assoc));
+    ns.set(newSymbol("dissoc"), newFn(dissoc));
+    ns.set(newSymbol("get"), newFn(get));
+    ns.set(newSymbol("contains?"), newFn(contains));
+    ns.set(newSymbol("keys"), newFn(keys));
+    ns.set(newSymbol("vals"), newFn(vals));
     ns.set(newSymbol("prn"), newFn(print));
     ns.set(newSymbol("type?"), newFn(type));
     ns.set(newSymbol("nvector"), newFn(nvector));
@@ -36,108 +55,442 @@ HashMap buildNamespace() {
     ns.set(newSymbol("randmat"), newFn(randomMatrix));
     ns.set(newSymbol("randmatf"), newFn(randomMatrixFloat));
     ns.set(newSymbol("transpose"), newFn(transposeMatrix));
+    ns.set(newSymbol("set-threads!"), newFn(setThreads));
     ns.set(newSymbol("env"), newFn(printEnv));
 
     return ns;
 }
 
-ObPtr add(std::vector<ObPtr> args, const Env& env) {
-    if (args.size() != 2)
-        throw TypeError("'+' takes 2 args, but " +
-                std::to_string(args.size()) + " were given");
-    return *args[0] + *args[1];
+// Arithmetic builtins fold any number of args from the left. (- x) is
+// the negation of x and (/ x) its reciprocal.
+
+static void requireArgs(Args args, const std::string& name) {
+    if (args.empty())
+        throw TypeError("'" + name + "' takes at least 1 args, but 0 were given");
+}
+
+ObPtr add(Args args, const Env& env) {
+    if (args.empty())
+        return newInteger(0);
+    return foldArithmetic(ArithOp::Add, args);
+}
+
+
+ObPtr subtract(Args args, const Env& env) {
+    requireArgs(args, "-");
+    if (args.size() == 1)
+        return arithmetic(ArithOp::Multiply, args[0], newInteger(-1));
+    return foldArithmetic(ArithOp::Subtract, args);
+}
+
+
+ObPtr multiply(Args args, const Env& env) {
+    if (args.empty())
+        return newInteger(1);
+    return foldArithmetic(ArithOp::Multiply, args);
+}
+
+
+ObPtr divide(Args args, const Env& env) {
+    requireArgs(args, "/");
+    if (args.size() == 1)
+        return arithmetic(ArithOp::Divide, newInteger(1), args[0]);
+    return foldArithmetic(ArithOp::Divide, args);
+}
+
+// Elements of a Matrix, or of an Nvector as a single row
+struct ArrayRows {
+    double* data;
+    int m;
+    int n;
+    long stride;
+    bool vector;
+};
+
+static ArrayRows arrayRows(const ObPtr& value, const std::string& name) {
+    if (value.is<Matrix>()) {
+        Matrix* mat = value->as<Matrix>();
+        return { mat->data(), mat->m(), mat->n(), mat->stride(), false };
+    }
+    if (value.is<Nvector>()) {
+        Nvector* vec = value->as<Nvector>();
+        return { vec->data(), 1, vec->size(), vec->size(), true };
+    }
+    throw TypeError("'" + name + "' requires a <Matrix> or an <Nvector>, not " +
+            value->typeRepr());
+}
+
+// The object an in-place builtin writes to. A buffer that is still shared,
+// e.g. with an unevaluated expression, is copied first.
+static ArrayRows inPlaceTarget(const ObPtr& target, const std::string& name) {
+    if (target.is<Matrix>())
+        target->as<Matrix>()->makeUnique();
+    else if (target.is<Nvector>())
+        target->as<Nvector>()->makeUnique();
+    return arrayRows(target, name);
+}
+
+static ArrayRows inPlaceOperand(const ArrayRows& target, const ObPtr& operand,
+                                const std::string& name) {
+    ArrayRows rows = arrayRows(operand, name);
+    if (rows.vector != target.vector || rows.m != target.m || rows.n != target.n)
+        throw ValueError("'" + name + "' operands must be the same size");
+    return rows;
 }
 
+// Calls fn(i, j0, len) on blocks covering every row of rows, in parallel
+template<typename Fn>
+static void forEachBlock(const ArrayRows& rows, Fn fn) {
+    const long block = 4096;
+    long blocks = (rows.n + block - 1) / block;
+    threadPool().parallelFor(0, rows.m * blocks, PARALLEL_GRAIN / block,
+                             [&](long lo, long hi) {
+        for (long s = lo; s < hi; s++) {
+            long j0 = s % blocks * block;
+            fn(s / blocks, j0, std::min(block, rows.n - j0));
+        }
+    });
+}
 
-ObPtr subtract(std::vector<ObPtr> args, const Env& env) {
+// (add! y x): y += x elementwise, x being a matching array or a scalar
+ObPtr addInPlace(Args args, const Env& env) {
     if (args.size() != 2)
-        throw TypeError("'-' takes 2 args, but " +
+        throw TypeError("'add!' takes 2 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] - *args[1];
+    ObPtr target = forceLazy(args[0]);
+    ArrayRows y = inPlaceTarget(target, "add!");
+    if (args[1].is<Numeric>()) {
+        double k = asFlt(args[1]);
+        forEachBlock(y, [&](long i, long j0, long len) {
+            double* out = y.data + i * y.stride + j0;
+            for (long j = 0; j < len; j++)
+                out[j] += k;
+        });
+        return target;
+    }
+    ObPtr operand = forceLazy(args[1]);
+    ArrayRows x = inPlaceOperand(y, operand, "add!");
+    forEachBlock(y, [&](long i, long j0, long len) {
+        double* out = y.data + i * y.stride + j0;
+        const double* in = x.data + i * x.stride + j0;
+        for (long j = 0; j < len; j++)
+            out[j] += in[j];
+    });
+    return target;
 }
 
-
-ObPtr multiply(std::vector<ObPtr> args, const Env& env) {
+// (scale! y k): y *= k
+ObPtr scaleInPlace(Args args, const Env& env) {
     if (args.size() != 2)
-        throw TypeError("'*' takes 2 args, but " +
+        throw TypeError("'scale!' takes 2 args, but " +
+                std::to_string(args.size()) + " were given");
+    double k = asFlt(args[1]);
+    ObPtr target = forceLazy(args[0]);
+    ArrayRows y = inPlaceTarget(target, "scale!");
+    forEachBlock(y, [&](long i, long j0, long len) {
+        double* out = y.data + i * y.stride + j0;
+        for (long j = 0; j < len; j++)
+            out[j] *= k;
+    });
+    return target;
+}
+
+// (axpy! y a x): y += a * x
+ObPtr axpyInPlace(Args args, const Env& env) {
+    if (args.size() != 3)
+        throw TypeError("'axpy!' takes 3 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] * *args[1];
+    double a = asFlt(args[1]);
+    ObPtr target = forceLazy(args[0]);
+    ArrayRows y = inPlaceTarget(target, "axpy!");
+    ObPtr operand = forceLazy(args[2]);
+    ArrayRows x = inPlaceOperand(y, operand, "axpy!");
+    forEachBlock(y, [&](long i, long j0, long len) {
+        double* out = y.data + i * y.stride + j0;
+        const double* in = x.data + i * x.stride + j0;
+        for (long j = 0; j < len; j++)
+            out[j] += a * in[j];
+    });
+    return target;
 }
 
+// Nvector argument of a reduction, forcing a deferred expression
+static ObPtr nvectorArg(const ObPtr& arg, const std::string& name) {
+    ObPtr value = forceLazy(arg);
+    if (!value.is<Nvector>())
+        throw TypeError("'" + name + "' requires an <Nvector>, not " +
+                value->typeRepr());
+    return value;
+}
 
-ObPtr divide(std::vector<ObPtr> args, const Env& env) {
-    if (args.size() != 2)
-        throw TypeError("'/' takes 2 args, but " +
+// Same, for reductions that have no value over an empty Nvector
+static ObPtr nonEmptyNvectorArg(const ObPtr& arg, const std::string& name) {
+    ObPtr value = nvectorArg(arg, name);
+    if (value->as<Nvector>()->size() == 0)
+        throw ValueError("'" + name + "' of an empty <Nvector>");
+    return value;
+}
+
+ObPtr nvectorSum(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'sum' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] / *args[1];
+    ObPtr vec = nvectorArg(args[0], "sum");
+    const Nvector* v = vec->as<Nvector>();
+    return newFloat(simdSum(v->data(), v->size()));
 }
 
-ObPtr equal(std::vector<ObPtr> args, const Env& env) {
+ObPtr nvectorDot(Args args, const Env& env) {
     if (args.size() != 2)
-        throw TypeError("'=' takes 2 args, but " +
+        throw TypeError("'dot' takes 2 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] == *args[1];
+    ObPtr lhs = nvectorArg(args[0], "dot");
+    ObPtr rhs = nvectorArg(args[1], "dot");
+    const Nvector* l = lhs->as<Nvector>();
+    const Nvector* r = rhs->as<Nvector>();
+    if (l->size() != r->size())
+        throw ValueError("NVectors must me the same size");
+    return newFloat(simdDot(l->data(), r->data(), l->size()));
 }
 
-ObPtr lessThan(std::vector<ObPtr> args, const Env& env) {
-    if (args.size() != 2)
-        throw TypeError("'<' takes 2 args, but " +
+ObPtr nvectorNorm(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'norm' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] < *args[1];
+    ObPtr vec = nvectorArg(args[0], "norm");
+    const Nvector* v = vec->as<Nvector>();
+    return newFloat(std::sqrt(simdDot(v->data(), v->data(), v->size())));
 }
 
-ObPtr lessEqual(std::vector<ObPtr> args, const Env& env) {
-    if (args.size() != 2)
-        throw TypeError("'<=' takes 2 args, but " +
+ObPtr nvectorMin(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'min' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] <= *args[1];
+    ObPtr vec = nonEmptyNvectorArg(args[0], "min");
+    const Nvector* v = vec->as<Nvector>();
+    return newFloat(simdMin(v->data(), v->size()));
 }
 
-ObPtr greaterThan(std::vector<ObPtr> args, const Env& env) {
-    if (args.size() != 2)
-        throw TypeError("'>' takes 2 args, but " +
+ObPtr nvectorMax(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'max' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] > *args[1];
+    ObPtr vec = nonEmptyNvectorArg(args[0], "max");
+    const Nvector* v = vec->as<Nvector>();
+    return newFloat(simdMax(v->data(), v->size()));
 }
 
-ObPtr greaterEqual(std::vector<ObPtr> args, const Env& env) {
-    if (args.size() != 2)
-        throw TypeError("'>=' takes 2 args, but " +
+ObPtr nvectorArgmax(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'argmax' takes 1 args, but " +
+                std::to_string(args.size()) + " were given");
+    ObPtr vec = nonEmptyNvectorArg(args[0], "argmax");
+    const Nvector* v = vec->as<Nvector>();
+    return newInteger(simdArgmax(v->data(), v->size()));
+}
+
+ObPtr nvectorMean(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'mean' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    return *args[0] >= *args[1];
+    ObPtr vec = nonEmptyNvectorArg(args[0], "mean");
+    const Nvector* v = vec->as<Nvector>();
+    return newFloat(simdSum(v->data(), v->size()) / v->size());
 }
 
-ObPtr list(std::vector<ObPtr> args, const Env& env) {
+// Comparisons hold between every two neighbouring args
+ObPtr equal(Args args, const Env& env) {
+    requireArgs(args, "=");
+    return newBool(comparisonChain(CompareOp::Equal, args));
+}
+
+ObPtr lessThan(Args args, const Env& env) {
+    requireArgs(args, "<");
+    return newBool(comparisonChain(CompareOp::Less, args));
+}
+
+ObPtr lessEqual(Args args, const Env& env) {
+    requireArgs(args, "<=");
+    return newBool(comparisonChain(CompareOp::LessEqual, args));
+}
+
+ObPtr greaterThan(Args args, const Env& env) {
+    requireArgs(args, ">");
+    return newBool(comparisonChain(CompareOp::Greater, args));
+}
+
+ObPtr greaterEqual(Args args, const Env& env) {
+    requireArgs(args, ">=");
+    return newBool(comparisonChain(CompareOp::GreaterEqual, args));
+}
+
+ObPtr list(Args args, const Env& env) {
     ObPtr result = newList();
     for (auto& e : args)
         result->as<List>()->push(e);
     return result;
 }
 
-ObPtr isList(std::vector<ObPtr> args, const Env& env) {
+ObPtr isList(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'list?' takes 1 args, but" +
                 std::to_string(args.size()) + " were given");
-    return newBool(args[0]->is<List>());
+    return newBool(args[0].is<List>());
 }
 
-ObPtr isSequenceEmpty(std::vector<ObPtr> args, const Env& env) {
+ObPtr isSequenceEmpty(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'empty?' takes 1 args, but" +
                 std::to_string(args.size()) + " were given");
     return newBool(args[0]->as<Sequence>()->empty());
 }
 
-ObPtr seqSize(std::vector<ObPtr> args, const Env& env) {
+ObPtr seqSize(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'count' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    if (args[0]->is<Nil>())
+    if (args[0].is<Nil>())
         return newInteger(0);
     return newInteger(args[0]->as<Sequence>()->size());
 }
 
-ObPtr print(std::vector<ObPtr> args, const Env& env) {
+// Index argument of name into a sequence of size elements, or also just
+// past them if orEnd
+static std::size_t indexArg(const ObPtr& arg, std::size_t size, const std::string& name,
+                            bool orEnd = false) {
+    long long idx = asInteger(arg);
+    if (idx < 0 || std::size_t(idx) > size || (std::size_t(idx) == size && !orEnd))
+        throw OutOfRange("'" + name + "' index " + std::to_string(idx) +
+                " out of range for size " + std::to_string(size));
+    return idx;
+}
+
+// A collection made from from by adding values. It stays detached (see
+// Object::detached) unless one of the values reaches an arena.
+static ObPtr derived(const Object& from, ObPtr res, Args values) {
+    if (from.detached() &&
+            std::none_of(values.begin(), values.end(), reachesArena))
+        res->markDetached();
+    return res;
+}
+
+ObPtr nth(Args args, const Env& env) {
+    if (args.size() != 2)
+        throw TypeError("'nth' takes 2 args, but " +
+                std::to_string(args.size()) + " were given");
+    const Sequence* seq = args[0]->as<Sequence>();
+    return seq->at(indexArg(args[1], seq->size(), "nth"));
+}
+
+// Vectors grow at the end, lists at the front
+ObPtr conj(Args args, const Env& env) {
+    if (args.size() < 2)
+        throw TypeError("'conj' takes at least 2 args, but " +
+                std::to_string(args.size()) + " were given");
+    Args values(args.begin() + 1, args.size() - 1);
+    if (args[0].is<List>()) {
+        const List* from = args[0]->as<List>();
+        std::vector<ObPtr> items(values.size() + from->size());
+        std::reverse_copy(values.begin(), values.end(), items.begin());
+        std::copy(from->begin(), from->end(), items.begin() + values.size());
+        return newList(items.cbegin(), items.cend());
+    }
+    const Vector* from = args[0]->as<Vector>();
+    PersistentVector::Builder items(from->items());
+    for (auto& e : values)
+        items.push(e);
+    return derived(*from, newVector(items.persistent()), values);
+}
+
+// (assoc map key value ...) or (assoc vector index value ...), where an
+// index may be the size, to append
+ObPtr assoc(Args args, const Env& env) {
+    if (args.size() < 3 || args.size() % 2 != 1)
+        throw TypeError("'assoc' takes a collection and key, value pairs, but " +
+                std::to_string(args.size()) + " args were given");
+    Args values(args.begin() + 1, args.size() - 1);
+    if (args[0].is<HashMap>()) {
+        const HashMap* from = args[0]->as<HashMap>();
+        PersistentMap::Builder items(from->items());
+        for (std::size_t i = 1; i < args.size(); i += 2)
+            items.set(args[i], args[i + 1]);
+        return derived(*from, newHashMap(items.persistent()), values);
+    }
+    const Vector* from = args[0]->as<Vector>();
+    PersistentVector::Builder items(from->items());
+    for (std::size_t i = 1; i < args.size(); i += 2)
+        items.set(indexArg(args[i], items.size(), "assoc", true), args[i + 1]);
+    return derived(*from, newVector(items.persistent()), values);
+}
+
+ObPtr dissoc(Args args, const Env& env) {
+    if (args.empty())
+        throw TypeError("'dissoc' takes at least 1 args, but 0 were given");
+    const HashMap* from = args[0]->as<HashMap>();
+    PersistentMap::Builder items(from->items());
+    for (std::size_t i = 1; i < args.size(); i++)
+        items.erase(args[i]);
+    return derived(*from, newHashMap(items.persistent()), Args(nullptr, 0));
+}
+
+// Value at key of a map, or at an index of a vector; nil holds nothing
+static const ObPtr* lookupIn(const ObPtr& coll, const ObPtr& key, const std::string& name) {
+    if (coll.is<Nil>())
+        return nullptr;
+    if (coll.is<Vector>()) {
+        const PersistentVector& items = coll->as<Vector>()->items();
+        if (!key.is<Integer>())
+            return nullptr;
+        long long idx = asInteger(key);
+        if (idx < 0 || std::size_t(idx) >= items.size())
+            return nullptr;
+        return &items[idx];
+    }
+    if (!coll.is<HashMap>())
+        throw TypeError("'" + name + "' takes a <HashMap> or <Vector>, not " +
+                coll->typeRepr());
+    return coll->as<HashMap>()->find(key);
+}
+
+// (get coll key) or (get coll key default), nil by default
+ObPtr get(Args args, const Env& env) {
+    if (args.size() != 2 && args.size() != 3)
+        throw TypeError("'get' takes 2 or 3 args, but " +
+                std::to_string(args.size()) + " were given");
+    const ObPtr* value = lookupIn(args[0], args[1], "get");
+    if (value)
+        return *value;
+    return args.size() == 3 ? args[2] : newNil();
+}
+
+ObPtr contains(Args args, const Env& env) {
+    if (args.size() != 2)
+        throw TypeError("'contains?' takes 2 args, but " +
+                std::to_string(args.size()) + " were given");
+    return newBool(lookupIn(args[0], args[1], "contains?") != nullptr);
+}
+
+ObPtr keys(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'keys' takes 1 args, but " +
+                std::to_string(args.size()) + " were given");
+    ObPtr result = newList();
+    for (auto& entry : *args[0]->as<HashMap>())
+        result->as<List>()->push(entry.key);
+    return result;
+}
+
+ObPtr vals(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'vals' takes 1 args, but " +
+                std::to_string(args.size()) + " were given");
+    ObPtr result = newList();
+    for (auto& entry : *args[0]->as<HashMap>())
+        result->as<List>()->push(entry.value);
+    return result;
+}
+
+ObPtr print(Args args, const Env& env) {
     if (args.size() > 0) {
         std::string out;
         for (auto& e : args)
@@ -148,7 +501,7 @@ ObPtr print(std::vector<ObPtr> args, const Env& env) {
     return newNil();
 }
 
-ObPtr type(std::vector<ObPtr> args, const Env& env) {
+ObPtr type(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError(
             "'type?' takes 1 args, but " + std::to_string(args.size()) + " were given"
@@ -156,18 +509,18 @@ ObPtr type(std::vector<ObPtr> args, const Env& env) {
     return newSymbol(args[0]->typeRepr());
 }
 
-ObPtr negation(std::vector<ObPtr> args, const Env& env) {
+ObPtr negation(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'not' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    return !*args[0];
+    return newBool(!truthy(args[0]));
 }
 
-ObPtr notEqual(std::vector<ObPtr> args, const Env& env) {
+ObPtr notEqual(Args args, const Env& env) {
     return !*equal(args, env);
 }
 
-ObPtr nvector(std::vector<ObPtr> args, const Env& env) {
+ObPtr nvector(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'nvector' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
@@ -175,94 +528,105 @@ ObPtr nvector(std::vector<ObPtr> args, const Env& env) {
         throw TypeError("'nvector' takes vector as argument");
     ObPtr res = newNvector();
     Nvector* resPtr = res->as<Nvector>();
-    for (const auto& e : *args[0]->as<Vector>()) {
-        if (!e->as<Numeric>())
-            throw TypeError("Value type must be <Numeric>: " + e->repr());
-        resPtr->push(e->as<Numeric>()->asFlt());
-    }
+    for (const auto& e : *args[0]->as<Vector>())
+        resPtr->push(asFlt(e));
     return res;
 }
 
-ObPtr matrix(std::vector<ObPtr> args, const Env& env) {
+ObPtr matrix(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'matrix' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
     if (!args[0]->as<Vector>())
         throw TypeError("'matrix' takes vector as argument");
-    ObPtr res = newMatrix();
-    Matrix* resPtr = res->as<Matrix>();
+    static const ObPtr separator = newSymbol(";");
 
-    int i = 0;
-    Nvector row;
+    std::vector<double> values;
+    int m = 0, n = 0, rowSize = 0;
     for (const auto& e : *args[0]->as<Vector>()) {
-        if (e->repr() == ";") {
-            if ((i == 0) || (*resPtr)[i - 1].size() == row.size()) {
-                resPtr->push(row);
-                row.clear();
-                i++;
-            } else
+        if (e == separator) {
+            if (m > 0 && rowSize != n)
                 throw ValueError("All rows in matrix must be the same size");
+            n = rowSize;
+            rowSize = 0;
+            m++;
+        }
+        else {
+            values.push_back(asFlt(e));
+            rowSize++;
         }
-        else if (!e->as<Numeric>())
-            throw TypeError("Value type must be <Numeric>: " + e->repr());
-        else 
-            row.push(e->as<Numeric>()->asFlt());
     }
-    if ((i == 0) || (*resPtr)[i - 1].size() == row.size())
-        resPtr->push(row);
-    else
+    if (m > 0 && rowSize != n)
         throw ValueError("All rows in matrix must be the same size");
+    n = rowSize;
+    m++;
 
+    ObPtr res = newMatrix(m, n);
+    Matrix* resPtr = res->as<Matrix>();
+    for (int i = 0; i < m; i++)
+        std::copy(values.begin() + i * n, values.begin() + (i + 1) * n,
+                  (*resPtr)[i]);
     return res;
 }
 
-ObPtr dotProduct(std::vector<ObPtr> args, const Env& env) {
+ObPtr dotProduct(Args args, const Env& env) {
     if (args.size() != 2)
         throw TypeError("'**' takes 2 args, but " +
                 std::to_string(args.size()) + " were given");
-    auto left = args[0]->as<Matrix>();
-    auto right = args[1]->as<Matrix>();
+    ObPtr leftOb = forceLazy(args[0]);
+    ObPtr rightOb = forceLazy(args[1]);
+    auto left = leftOb->as<Matrix>();
+    auto right = rightOb->as<Matrix>();
     if (!left || !right)
         throw TypeError("'**' required 2 matrices");
     return left->dot(*right);
 }
 
-ObPtr eye(std::vector<ObPtr> args, const Env& env) {
+ObPtr eye(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'**' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
     auto arg = args[0]->as<Integer>();
     if (!arg)
         throw TypeError("'eye' argument must be an <Integer> type");
-    auto res = newMatrix();
+    int sz = arg->value();
+    auto res = newMatrix(sz, sz);
     auto resm = res->as<Matrix>();
-    for (int i = 0, sz = arg->value(); i < sz; i++) {
-        resm->addEmptyRow();
-        for (int j = 0; j < sz; j++) {
-            (*resm)[i].push(i == j ? 1 : 0);
-        }
-    }
+    for (int i = 0; i < sz; i++)
+        (*resm)[i][i] = 1;
     return res;
 }
 
-ObPtr zeros(std::vector<ObPtr> args, const Env& env) {
+ObPtr zeros(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'**' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
     auto arg = args[0]->as<Integer>();
     if (!arg)
         throw TypeError("'eye' argument must be an <Integer> type");
-    auto res = newMatrix();
-    auto resm = res->as<Matrix>();
-    for (int i = 0, sz = arg->value(); i < sz; i++) {
-        resm->addEmptyRow();
-        for (int j = 0; j < sz; j++)
-            (*resm)[i].push(0);
-    }
-    return res;
+    int sz = arg->value();
+    return newMatrix(sz, sz);
+}
+
+// Fills rows in parallel, each task drawing from its own generator seeded
+// with the clock and the first row it covers
+template<typename Dist>
+static void fillRandom(Matrix& mat, Dist dist) {
+    unsigned seed = time(nullptr);
+    threadPool().parallelFor(0, mat.m(), parallelRowGrain(mat.n()),
+                             [&](long lo, long hi) {
+        std::seed_seq seq { seed, unsigned(lo) };
+        std::mt19937 gen(seq);
+        Dist taskDist = dist;
+        for (long i = lo; i < hi; i++) {
+            double* row = mat[i];
+            for (int j = 0; j < mat.n(); j++)
+                row[j] = taskDist(gen);
+        }
+    });
 }
 
-ObPtr randomMatrixFloat(std::vector<ObPtr> args, const Env& env) {
+ObPtr randomMatrixFloat(Args args, const Env& env) {
     if (args.size() < 1 || args.size() > 4)
         throw TypeError("'randmat' args (m [n = m] [min = 0] [max = INT_MAX]), but " +
                 std::to_string(args.size()) + " were given");
@@ -292,19 +656,13 @@ ObPtr randomMatrixFloat(std::vector<ObPtr> args, const Env& env) {
     if (max < min)
         throw ValueError("Max value < min value");
 
-    auto res = newMatrix();
-    auto resm = res->as<Matrix>();
-    srand(time(nullptr));
-    for (int i = 0; i < m; i++) {
-        resm->addEmptyRow();
-        for (int j = 0; j < n; j++) {
-            (*resm)[i].push(min + double(rand()) / (double(RAND_MAX)/(max - min)));
-        }
-    }
+    auto res = newMatrix(m, n);
+    fillRandom(*res->as<Matrix>(),
+               std::uniform_real_distribution<double>(min, max));
     return res;
 }
 
-ObPtr randomMatrix(std::vector<ObPtr> args, const Env& env) {
+ObPtr randomMatrix(Args args, const Env& env) {
     if (args.size() < 1 || args.size() > 4)
         throw TypeError("'randmat' args (m [n = m] [min = 0] [max = INT_MAX]), but " +
                 std::to_string(args.size()) + " were given");
@@ -334,44 +692,52 @@ ObPtr randomMatrix(std::vector<ObPtr> args, const Env& env) {
     if (max < min)
         throw ValueError("Max value < min value");
 
-    auto res = newMatrix();
-    auto resm = res->as<Matrix>();
-    srand(time(nullptr));
-    for (int i = 0; i < m; i++) {
-        resm->addEmptyRow();
-        for (int j = 0; j < n; j++) {
-            (*resm)[i].push(rand() % (max - min) + min);
-        }
-    }
+    auto res = newMatrix(m, n);
+    fillRandom(*res->as<Matrix>(),
+               std::uniform_int_distribution<int>(min, std::max(min, max - 1)));
     return res;
 }
 
-ObPtr transposeMatrix(std::vector<ObPtr> args, const Env& env) {
+ObPtr transposeMatrix(Args args, const Env& env) {
     if (args.size() != 1)
         throw TypeError("'**' takes 1 args, but " +
                 std::to_string(args.size()) + " were given");
-    auto arg = args[0]->as<Matrix>();
+    ObPtr argOb = forceLazy(args[0]);
+    auto arg = argOb->as<Matrix>();
     if (!arg)
         throw TypeError("'eye' argument must be an <Integer> type");
     int m = arg->m();
     int n = arg->n();
-    auto res = newMatrix();
+    auto res = newMatrix(n, m);
     auto resm = res->as<Matrix>();
-    for (int i = 0; i < n; i++) {
-        resm->addEmptyRow();
-        for (int j = 0; j < m; j++)
-            (*resm)[i].push((*arg)[j][i]);
-    }
+    // Each task owns whole rows of the result, so no two write a cache line
+    threadPool().parallelFor(0, n, parallelRowGrain(m), [&](long lo, long hi) {
+        for (long i = lo; i < hi; i++) {
+            double* out = (*resm)[i];
+            for (int j = 0; j < m; j++)
+                out[j] = (*arg)[j][i];
+        }
+    });
     return res;
 }
 
-ObPtr printEnv(std::vector<ObPtr> args, const Env& env) {
+ObPtr setThreads(Args args, const Env& env) {
+    if (args.size() != 1)
+        throw TypeError("'set-threads!' takes 1 args, but " +
+                std::to_string(args.size()) + " were given");
+    auto arg = args[0]->as<Integer>();
+    if (arg->value() < 1 || arg->value() > MAX_THREADS)
+        throw ValueError("'set-threads!' argument must be in [1, " +
+                std::to_string(MAX_THREADS) + "]");
+    threadPool().resize(arg->value());
+    return newNil();
+}
+
+ObPtr printEnv(Args args, const Env& env) {
     if (args.size() > 0)
         throw TypeError("'env' takes 0 args, but " +
                 std::to_string(args.size()) + " were given");
-    for (auto it = env.cbegin(); it != env.cend(); it++) {
-        std::cout << it->first->repr() << ": "
-                  << it->second->typeRepr() << '\n';
-    }
+    for (auto& [key, value] : env.bindings())
+        std::cout << key->repr() << ": " << value->typeRepr() << '\n';
     return newNil();
 }
@@ -1,47 +1,72 @@
 #ifndef _CORE_H_
 #define _CORE_H_
 
+#include <algorithm>
 #include <climits>
+#include <cmath>
 #include <random>
 #include <string>
 #include <vector>
 #include <unordered_map>
 
+#include "arena.h"
 #include "environment.h"
 #include "exceptions.h"
 #include "printer.h"
+#include "simd.h"
+#include "threadpool.h"
 #include "types.h"
 
 
 HashMap buildNamespace();
 
-ObPtr add(std::vector<ObPtr> args, const Env& env);
-ObPtr subtract(std::vector<ObPtr> args, const Env& env);
-ObPtr multiply(std::vector<ObPtr> args, const Env& env);
-ObPtr divide(std::vector<ObPtr> args, const Env& env);
-
-ObPtr equal(std::vector<ObPtr> args, const Env& env);
-ObPtr notEqual(std::vector<ObPtr> args, const Env& env);
-ObPtr lessThan(std::vector<ObPtr> args, const Env& env);
-ObPtr lessEqual(std::vector<ObPtr> args, const Env& env);
-ObPtr greaterThan(std::vector<ObPtr> args, const Env& env);
-ObPtr greaterEqual(std::vector<ObPtr> args, const Env& env);
-ObPtr negation(std::vector<ObPtr> args, const Env& env);
-
-ObPtr list(std::vector<ObPtr> args, const Env& env);
-ObPtr isList(std::vector<ObPtr> args, const Env& env);
-ObPtr isSequenceEmpty(std::vector<ObPtr> args, const Env& env);
-ObPtr seqSize(std::vector<ObPtr> args, const Env& env);
-ObPtr print(std::vector<ObPtr> args, const Env& env);
-ObPtr type(std::vector<ObPtr> args, const Env& env);
-ObPtr nvector(std::vector<ObPtr> args, const Env& env);
-ObPtr matrix(std::vector<ObPtr> args, const Env& env);
-ObPtr dotProduct(std::vector<ObPtr> args, const Env& env);
-ObPtr eye(std::vector<ObPtr> args, const Env& env);
-ObPtr zeros(std::vector<ObPtr> args, const Env& env);
-ObPtr randomMatrix(std::vector<ObPtr> args, const Env& env);
-ObPtr randomMatrixFloat(std::vector<ObPtr> args, const Env& env);
-ObPtr transposeMatrix(std::vector<ObPtr> args, const Env& env);
-ObPtr printEnv(std::vector<ObPtr> args, const Env& env);
+ObPtr add(Args args, const Env& env);
+ObPtr subtract(Args args, const Env& env);
+ObPtr multiply(Args args, const Env& env);
+ObPtr divide(Args args, const Env& env);
+ObPtr addInPlace(Args args, const Env& env);
+ObPtr scaleInPlace(Args args, const Env& env);
+ObPtr axpyInPlace(Args args, const Env& env);
+
+ObPtr nvectorSum(Args args, const Env& env);
+ObPtr nvectorDot(Args args, const Env& env);
+ObPtr nvectorNorm(Args args, const Env& env);
+ObPtr nvectorMin(Args args, const Env& env);
+ObPtr nvectorMax(Args args, const Env& env);
+ObPtr nvectorArgmax(Args args, const Env& env);
+ObPtr nvectorMean(Args args, const Env& env);
+
+ObPtr equal(Args args, const Env& env);
+ObPtr notEqual(Args args, const Env& env);
+ObPtr lessThan(Args args, const Env& env);
+ObPtr lessEqual(Args args, const Env& env);
+ObPtr greaterThan(Args args, const Env& env);
+ObPtr greaterEqual(Args args, const Env& env);
+ObPtr negation(Args args, const Env& env);
+
+ObPtr list(Args args, const Env& env);
+ObPtr isList(Args args, const Env& env);
+ObPtr isSequenceEmpty(Args args, const Env& env);
+ObPtr seqSize(Args args, const Env& env);
+ObPtr nth(Args args, const Env& env);
+ObPtr conj(Args args, const Env& env);
+ObPtr assoc(Args args, const Env& env);
+ObPtr dissoc(Args args, const Env& env);
+ObPtr get(Args args, const Env& env);
+ObPtr contains(Args args, const Env& env);
+ObPtr keys(Args args, const Env& env);
+ObPtr vals(Args args, const Env& env);
+ObPtr print(Args args, const Env& env);
+ObPtr type(Args args, const Env& env);
+ObPtr nvector(Args args, const Env& env);
+ObPtr matrix(Args args, const Env& env);
+ObPtr dotProduct(Args args, const Env& env);
+ObPtr eye(Args args, const Env& env);
+ObPtr zeros(Args args, const Env& env);
+ObPtr randomMatrix(Args args, const Env& env);
+ObPtr randomMatrixFloat(Args args, const Env& env);
+ObPtr setThreads(Args args, const Env& env);
+ObPtr transposeMatrix(Args args, const Env& env);
+ObPtr printEnv(Args args, const Env& env);
 
 #endif
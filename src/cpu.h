@@ -0,0 +1,16 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+
+// Instruction set extensions of the CPU we are running on, detected once
+// at startup. Kernels built with target attributes check these before
+// being selected.
+struct CpuFeatures {
+    bool sse2;
+    bool avx2;
+    bool fma;
+};
+
+const CpuFeatures& cpuFeatures();
+
+#endif
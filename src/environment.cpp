@@ -2,11 +2,14 @@
 #include "exceptions.h"
 
 
-Env::Env(const Env* outer, ObPtr binds, ObPtr exprs) : outer_(outer) {
-    if (!(binds->is<List>() && exprs->is<List>()))
+unsigned Env::version_ = 1;
+bool Env::looseLocals_ = false;
+
+Env::Env(EnvPtr outer, ObPtr binds, ObPtr exprs) : outer_(outer) {
+    if (!(binds.is<Sequence>() && exprs.is<List>()))
         throw TypeError(binds->repr() + " and " + exprs->repr() +
                 " must be lists");
-    List* bPtr = binds->as<List>();
+    Sequence* bPtr = binds->as<Sequence>();
     List* ePtr = exprs->as<List>();
     if (bPtr->size() != ePtr->size())
         throw TypeError(binds->repr() + " and " + exprs->repr() +
@@ -18,8 +21,54 @@ Env::Env(const Env* outer, ObPtr binds, ObPtr exprs) : outer_(outer) {
     }
 }
 
+// Slot of the bound local named key, or -1. Later names shadow earlier
+// ones, as repeated parameters do.
+int Env::slotOf(const ObPtr& key) const {
+    if (!names_)
+        return -1;
+    const Vector* names = names_->as<Vector>();
+    for (int i = names->size() - 1; i >= 0; i--)
+        if (names->at(i) == key)
+            return slots_[i] ? i : -1;
+    return -1;
+}
+
+void Env::set(const ObPtr& key, const ObPtr& value) {
+    if (names_) {
+        const Vector* names = names_->as<Vector>();
+        for (int i = names->size() - 1; i >= 0; i--)
+            if (names->at(i) == key) {
+                slots_[i] = value;
+                return;
+            }
+        looseLocals_ = true;
+    }
+    data_[key] = value;
+    version_++;
+}
+
+void Env::clear() {
+    data_.clear();
+    slots_.assign(slots_.size(), nullptr);
+    version_++;
+}
+
+void Env::references(std::vector<const ObPtr*>& values,
+                     std::vector<const Collectable*>& frames) const {
+    for (const ObPtr& value : slots_)
+        values.push_back(&value);
+    for (auto it = cbegin(); it != cend(); it++)
+        values.push_back(&it->second);
+    frames.push_back(outer_.get());
+}
+
+void Env::dropReferences() {
+    clear();
+    outer_.reset();
+}
+
 const Env* Env::find(const ObPtr& key) const {
-    if (data_.has(key))
+    if (slotOf(key) >= 0 || data_.count(key))
         return this;
     else if (outer_)
         return outer_->find(key);
@@ -27,9 +76,46 @@ const Env* Env::find(const ObPtr& key) const {
         return nullptr;
 }
 
+// Like get(), but returns the stored binding itself. It stays valid
+// until the key is unbound.
+const ObPtr* Env::lookup(const ObPtr& key) const {
+    for (const Env* env = this; env; env = env->outer_.get()) {
+        int slot = env->slotOf(key);
+        if (slot >= 0)
+            return &env->slots_[slot];
+        auto it = env->data_.find(key);
+        if (it != env->data_.end())
+            return &it->second;
+    }
+    throw NotFound(key->repr());
+}
+
 ObPtr Env::get(const ObPtr& key) const {
-    const Env* env = find(key);
-    if (env)
-        return env->data_.get(key);
-    else throw NotFound(key->repr());
+    for (const Env* env = this; env; env = env->outer_.get()) {
+        int slot = env->slotOf(key);
+        if (slot >= 0)
+            return env->slots_[slot];
+        auto it = env->data_.find(key);
+        if (it != env->data_.end())
+            return it->second;
+    }
+    throw NotFound(key->repr());
+}
+
+std::vector<std::pair<ObPtr, ObPtr>> Env::bindings() const {
+    std::vector<std::pair<ObPtr, ObPtr>> result;
+    for (std::size_t i = 0; i < slots_.size(); i++)
+        if (slots_[i] && slotOf(names_->as<Vector>()->at(i)) == int(i))
+            result.emplace_back(names_->as<Vector>()->at(i), slots_[i]);
+    for (auto it = cbegin(); it != cend(); it++)
+        result.emplace_back(it->first, it->second);
+    return result;
+}
+
+const ObPtr& GlobalSym::lookup(const Env& env) const {
+    if (!value_ || version_ != Env::version() || Env::looseLocals()) {
+        value_ = env.lookup(symbol_);
+        version_ = Env::version();
+    }
+    return *value_;
 }
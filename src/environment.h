@@ -1,22 +1,73 @@
 #ifndef _ENVIRONMENT_H_
 #define _ENVIRONMENT_H_
 
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "collector.h"
 #include "types.h"
 
 
-class Env{
+// Hashed bindings. Unlike a HashMap's entries, these stay in place while
+// others are added, so lookup() can hand out pointers to them.
+typedef std::unordered_map<ObPtr, ObPtr, ValueHash, HashMapPred> Bindings;
+
+// Bindings of one scope. Globals and frames of unresolved forms keep
+// them in data_. Frames of let* and fn* forms that resolve() rewrote are
+// flat: slots_[i] holds the local named (*names_)[i], or null while it
+// is unbound, and data_ only takes names the resolver did not see.
+class Env : public Collectable {
 public:
-    HashMap data_;
-    const Env *outer_;
+    Bindings data_;
+    EnvPtr outer_;
+    ObPtr names_;
+    std::vector<ObPtr> slots_;
+
+private:
+    static unsigned version_;
+    static bool looseLocals_;
+    int slotOf(const ObPtr& key) const;
 
 public:
     Env() : outer_(nullptr) { };
-    Env(const Env* outer) : outer_(outer) { };
-    Env(const Env* outer, ObPtr binds, ObPtr exprs);
+    Env(EnvPtr outer) : outer_(outer) { };
+    Env(EnvPtr outer, ObPtr binds, ObPtr exprs);
+    // Flat frame for the locals in names
+    Env(EnvPtr outer, const ObPtr& names)
+        : outer_(outer), names_(names),
+          slots_(names->as<Vector>()->size()) { };
     const Env* find(const ObPtr& key) const;
     ObPtr get(const ObPtr& key) const;
-    void set(const ObPtr& key, const ObPtr& value) { data_.set(key, value); }
-    
+    const ObPtr* lookup(const ObPtr& key) const;
+    void set(const ObPtr& key, const ObPtr& value);
+    void clear();
+
+    void references(std::vector<const ObPtr*>& values,
+                    std::vector<const Collectable*>& frames) const;
+    void dropReferences();
+
+    // Local resolved to (depth, slot). A slot that is not bound yet
+    // falls back to looking the name up further out, as before.
+    ObPtr local(int depth, int slot, const ObPtr& symbol) const {
+        const Env* env = this;
+        while (depth-- > 0)
+            env = env->outer_.get();
+        const ObPtr& value = env->slots_[slot];
+        if (value)
+            return value;
+        return env->outer_->get(symbol);
+    }
+
+    // Bumped whenever a hashed binding is added or removed, which is
+    // what can change the result of a global lookup
+    static unsigned version() { return version_; }
+    // Set once a flat frame has taken a binding in data_; global lookups
+    // are not cached after that
+    static bool looseLocals() { return looseLocals_; }
+
+    std::vector<std::pair<ObPtr, ObPtr>> bindings() const;
+
     auto begin() { return data_.begin(); };
     auto end() { return data_.end(); };
     auto cbegin() const { return data_.cbegin(); };
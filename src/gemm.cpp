@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_X86 1
+#endif
+
+#include "aligned.h"
+#include "cpu.h"
+#include "gemm.h"
+#include "threadpool.h"
+
+
+// One micro-kernel call computes an MR x NR block of C in registers. An
+// MC x KC panel of A is packed to stay in L2 while a KC x NR sliver of
+// the packed KC x NC block of B streams through L1.
+const static int MR = 6;
+const static int NR = 8;
+const static int MC = 96;
+const static int KC = 256;
+const static int NC = 2048;
+
+// Below this many multiply-adds, packing costs more than it saves
+const static long SMALL_GEMM = 48 * 48 * 48;
+
+// Rows of C per parallel task: every task packs its own copy of B, which
+// stays cheap next to 2 * ROWS_PER_TASK flops per packed element
+const static int ROWS_PER_TASK = 4 * MR;
+
+typedef void (*MicroKernel)(int kc, const double* a, const double* b,
+                            double* c, int ldc);
+
+
+// c (MR x NR) += a * b, where a is an MR-row panel and b an NR-column
+// panel, both packed k-major
+static void microKernelScalar(int kc, const double* a, const double* b,
+                              double* c, int ldc) {
+    double acc[MR][NR] = { };
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < MR; i++)
+            for (int j = 0; j < NR; j++)
+                acc[i][j] += a[i] * b[j];
+        a += MR;
+        b += NR;
+    }
+    for (int i = 0; i < MR; i++)
+        for (int j = 0; j < NR; j++)
+            c[i * ldc + j] += acc[i][j];
+}
+
+#ifdef GEMM_X86
+// Same contract as microKernelScalar: 12 ymm accumulators hold the 6 x 8
+// block, each step broadcasts one element of a and loads a row of b
+__attribute__((target("avx2,fma")))
+static void microKernelAvx2(int kc, const double* a, const double* b,
+                            double* c, int ldc) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+    __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+
+    for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_load_pd(b);
+        __m256d b1 = _mm256_load_pd(b + 4);
+        __m256d ai;
+        ai = _mm256_broadcast_sd(a + 0);
+        c00 = _mm256_fmadd_pd(ai, b0, c00);
+        c01 = _mm256_fmadd_pd(ai, b1, c01);
+        ai = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(ai, b0, c10);
+        c11 = _mm256_fmadd_pd(ai, b1, c11);
+        ai = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(ai, b0, c20);
+        c21 = _mm256_fmadd_pd(ai, b1, c21);
+        ai = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(ai, b0, c30);
+        c31 = _mm256_fmadd_pd(ai, b1, c31);
+        ai = _mm256_broadcast_sd(a + 4);
+        c40 = _mm256_fmadd_pd(ai, b0, c40);
+        c41 = _mm256_fmadd_pd(ai, b1, c41);
+        ai = _mm256_broadcast_sd(a + 5);
+        c50 = _mm256_fmadd_pd(ai, b0, c50);
+        c51 = _mm256_fmadd_pd(ai, b1, c51);
+        a += MR;
+        b += NR;
+    }
+
+    __m256d acc[MR][2] = {
+        { c00, c01 }, { c10, c11 }, { c20, c21 },
+        { c30, c31 }, { c40, c41 }, { c50, c51 },
+    };
+    for (int i = 0; i < MR; i++) {
+        double* row = c + i * ldc;
+        _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), acc[i][0]));
+        _mm256_storeu_pd(row + 4,
+                         _mm256_add_pd(_mm256_loadu_pd(row + 4), acc[i][1]));
+    }
+}
+#endif
+
+static MicroKernel selectMicroKernel() {
+#ifdef GEMM_X86
+    if (cpuFeatures().avx2 && cpuFeatures().fma)
+        return microKernelAvx2;
+#endif
+    return microKernelScalar;
+}
+
+// Packs an mc x kc block of a into MR-row panels, zero padding the last
+static void packA(int mc, int kc, const double* a, int lda, double* packed) {
+    for (int i = 0; i < mc; i += MR) {
+        int rows = std::min(MR, mc - i);
+        for (int p = 0; p < kc; p++) {
+            for (int r = 0; r < rows; r++)
+                *packed++ = a[(i + r) * lda + p];
+            for (int r = rows; r < MR; r++)
+                *packed++ = 0;
+        }
+    }
+}
+
+// Packs a kc x nc block of b into NR-column panels, zero padding the last
+static void packB(int kc, int nc, const double* b, int ldb, double* packed) {
+    for (int j = 0; j < nc; j += NR) {
+        int cols = std::min(NR, nc - j);
+        for (int p = 0; p < kc; p++) {
+            const double* row = b + p * ldb + j;
+            for (int col = 0; col < cols; col++)
+                *packed++ = row[col];
+            for (int col = cols; col < NR; col++)
+                *packed++ = 0;
+        }
+    }
+}
+
+static void gemmBlocked(int m, int n, int k,
+                        const double* a, int lda,
+                        const double* b, int ldb,
+                        double* c, int ldc) {
+    static const MicroKernel kernel = selectMicroKernel();
+
+    for (int i = 0; i < m; i++)
+        std::memset(c + i * ldc, 0, n * sizeof(double));
+
+    // Sized for the largest blocks this product actually uses
+    const int kcMax = std::min(KC, k);
+    const int mcMax = (std::min(MC, m) + MR - 1) / MR * MR;
+    const int ncMax = (std::min(NC, n) + NR - 1) / NR * NR;
+    std::vector<double, AlignedAllocator<double>> packedA(mcMax * kcMax);
+    std::vector<double, AlignedAllocator<double>> packedB(kcMax * ncMax);
+    alignas(BUFFER_ALIGNMENT) double edge[MR * NR];
+
+    for (int jc = 0; jc < n; jc += NC) {
+        int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            packB(kc, nc, b + pc * ldb + jc, ldb, packedB.data());
+            for (int ic = 0; ic < m; ic += MC) {
+                int mc = std::min(MC, m - ic);
+                packA(mc, kc, a + ic * lda + pc, lda, packedA.data());
+                for (int jr = 0; jr < nc; jr += NR) {
+                    int nr = std::min(NR, nc - jr);
+                    for (int ir = 0; ir < mc; ir += MR) {
+                        int mr = std::min(MR, mc - ir);
+                        const double* ap = packedA.data() + ir * kc;
+                        const double* bp = packedB.data() + jr * kc;
+                        double* cp = c + (ic + ir) * ldc + jc + jr;
+                        if (mr == MR && nr == NR) {
+                            kernel(kc, ap, bp, cp, ldc);
+                            continue;
+                        }
+                        // Partial block at the bottom or right edge of C
+                        std::fill(edge, edge + MR * NR, 0.0);
+                        kernel(kc, ap, bp, edge, NR);
+                        for (int i = 0; i < mr; i++)
+                            for (int j = 0; j < nr; j++)
+                                cp[i * ldc + j] += edge[i * NR + j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void gemm(int m, int n, int k,
+          const double* a, int lda,
+          const double* b, int ldb,
+          double* c, int ldc) {
+    if (long(m) * n * k <= SMALL_GEMM)
+        return gemmNaive(m, n, k, a, lda, b, ldb, c, ldc);
+
+    // Bands of rows of C are independent products
+    threadPool().parallelFor(0, m, ROWS_PER_TASK, [=](long lo, long hi) {
+        gemmBlocked(hi - lo, n, k, a + lo * lda, lda, b, ldb,
+                    c + lo * ldc, ldc);
+    });
+}
+
+void gemmNaive(int m, int n, int k,
+               const double* a, int lda,
+               const double* b, int ldb,
+               double* c, int ldc) {
+    for (int i = 0; i < m; i++) {
+        double* out = c + i * ldc;
+        std::fill(out, out + n, 0.0);
+        for (int p = 0; p < k; p++) {
+            const double aip = a[i * lda + p];
+            const double* row = b + p * ldb;
+            for (int j = 0; j < n; j++)
+                out[j] += aip * row[j];
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _GEMM_H_
+#define _GEMM_H_
+
+
+// C (m x n) = A (m x k) * B (k x n). Matrices are row-major with leading
+// dimensions lda, ldb and ldc (doubles between row starts); C is
+// overwritten.
+void gemm(int m, int n, int k,
+          const double* a, int lda,
+          const double* b, int ldb,
+          double* c, int ldc);
+
+// Straightforward i-k-j loop with the same contract, the reference that
+// the blocked kernels are checked against.
+void gemmNaive(int m, int n, int k,
+               const double* a, int lda,
+               const double* b, int ldb,
+               double* c, int ldc);
+
+#endif
@@ -1,38 +1,86 @@
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 #include <typeinfo>
+#include <unistd.h>
 
+#include "collector.h"
 #include "core.h"
 #include "environment.h"
 #include "linenoise.hpp"
 #include "repl.h"
+#include "vm.h"
 
 
 const char* HISTORY_PATH = "history.txt";
 
 
-int main() {
-    linenoise::LoadHistory(HISTORY_PATH);
+int main(int argc, char* argv[]) {
+    bool useVm = false;
+    const char* script = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--engine=vm")
+            useVm = true;
+        else if (arg == "--engine=tree")
+            useVm = false;
+        else if (!script && (arg == "-" || arg[0] != '-'))
+            script = argv[i];
+        else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--engine=tree|vm] [file | -]\n";
+            return 1;
+        }
+    }
+    // Piped input is run as a script rather than through linenoise
+    if (!script && !isatty(STDIN_FILENO))
+        script = "-";
 
-    Env coreEnv;
+    EnvPtr coreEnv(new Env);
     for (auto& e : buildNamespace())
-        coreEnv.set(e.first, e.second);
+        coreEnv->set(e.key, e.value);
+
+    EnvPtr replEnv(new Env(coreEnv));
+    VM vm(replEnv);
+
+    int status = 0;
+    if (script) {
+        std::ifstream file;
+        if (std::string(script) != "-") {
+            file.open(script);
+            if (!file) {
+                std::cerr << "Can't open " << script << '\n';
+                return 1;
+            }
+        }
+        std::istream& in = file.is_open() ? file : std::cin;
+        bool ok = useVm ? runScript(in, vm) : runScript(in, replEnv);
+        status = ok ? 0 : 1;
+    } else {
+        linenoise::LoadHistory(HISTORY_PATH);
 
-    Env replEnv(&coreEnv);
+        std::string prompt = CYAN + ">>> " + RESET;
+        std::string line;
 
-    std::string prompt = CYAN + ">>> " + RESET;
-    std::string line;
+        for(;;) {
+            auto quit = linenoise::Readline(prompt.c_str(), line);
+            if (quit)
+                break;
+            if (useVm)
+                std::cout << rep(line, vm) << std::endl;
+            else
+                std::cout << rep(line, replEnv) << std::endl;
+            linenoise::AddHistory(line.c_str());
+        }
 
-    for(;;) {
-        auto status = linenoise::Readline(prompt.c_str(), line);
-        if (status)
-            break;
-        std::cout << rep(line, replEnv) << std::endl;
-        linenoise::AddHistory(line.c_str());
+        linenoise::SaveHistory(HISTORY_PATH);
     }
 
-    linenoise::SaveHistory(HISTORY_PATH);
+    // Closures defined at top level capture replEnv, which holds them.
+    // Frames kept alive by the closures made in them go with the rest.
+    replEnv->clear();
+    collectCycles();
 
-    return 0;
+    return status;
 }
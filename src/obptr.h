@@ -0,0 +1,125 @@
+#ifndef _OBPTR_H_
+#define _OBPTR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+class Object;
+enum class TypeTag : unsigned char;
+
+
+// Handle to a value, one word wide. Integers that fit in 48 bits, all
+// doubles, true, false and nil are stored in the word itself (NaN
+// boxing); anything else is a pointer to an Object that keeps its own
+// reference count. The word is one of:
+//
+//   0                                   null
+//   2, 4, 6                             nil, false, true
+//   [8, 2^49)                           Object*
+//   [2^49, 0xFFF2'0000'0000'0000]       double bits + 2^49
+//   0xFFFF'xxxx'xxxx'xxxx               48-bit integer
+//
+// Dereferencing an immediate still gives an Object, so code that is not
+// performance sensitive can treat every value alike: nil, true, false
+// and small integers map to shared instances, and other numbers are
+// boxed the first time, turning that handle into an ordinary reference.
+// Hot paths test isInteger() / isFloat() and friends first instead.
+class ObPtr {
+    static constexpr std::uint64_t NIL_BITS = 2;
+    static constexpr std::uint64_t FALSE_BITS = 4;
+    static constexpr std::uint64_t TRUE_BITS = 6;
+    static constexpr std::uint64_t DOUBLE_OFFSET = std::uint64_t(1) << 49;
+    static constexpr std::uint64_t INT_TAG = 0xFFFF000000000000;
+    static constexpr std::uint64_t INT_MASK = 0x0000FFFFFFFFFFFF;
+    static constexpr std::uint64_t CANONICAL_NAN = 0x7FF8000000000000;
+
+    mutable std::uint64_t bits_;
+
+    explicit ObPtr(std::uint64_t bits, int) : bits_(bits) { };
+    Object* object() const { return reinterpret_cast<Object*>(bits_); }
+    Object* box() const;
+    inline void retain() const;
+    inline void release() const;
+public:
+    static constexpr long long IMMEDIATE_MIN = -(1LL << 47);
+    static constexpr long long IMMEDIATE_MAX = (1LL << 47) - 1;
+
+    ObPtr() : bits_(0) { };
+    ObPtr(std::nullptr_t) : bits_(0) { };
+    explicit ObPtr(Object* ptr) : bits_(reinterpret_cast<std::uint64_t>(ptr)) {
+        retain();
+    }
+    ObPtr(const ObPtr& other) : bits_(other.bits_) { retain(); }
+    ObPtr(ObPtr&& other) noexcept : bits_(other.bits_) { other.bits_ = 0; }
+    ~ObPtr() { release(); }
+
+    ObPtr& operator=(const ObPtr& other) {
+        ObPtr(other).swap(*this);
+        return *this;
+    }
+    ObPtr& operator=(ObPtr&& other) noexcept {
+        ObPtr(std::move(other)).swap(*this);
+        return *this;
+    }
+    ObPtr& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    // Immediates. integer() takes IMMEDIATE_MIN..IMMEDIATE_MAX.
+    static ObPtr integer(long long val) {
+        return ObPtr(INT_TAG | (std::uint64_t(val) & INT_MASK), 0);
+    }
+    static ObPtr flt(double val) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &val, sizeof bits);
+        if ((bits & 0x7FF0000000000000) == 0x7FF0000000000000 &&
+                (bits & 0x000FFFFFFFFFFFFF))
+            bits = CANONICAL_NAN;
+        return ObPtr(bits + DOUBLE_OFFSET, 0);
+    }
+    static ObPtr nil() { return ObPtr(NIL_BITS, 0); }
+    static ObPtr boolean(bool val) { return ObPtr(val ? TRUE_BITS : FALSE_BITS, 0); }
+
+    bool isObject() const { return bits_ - 8 < DOUBLE_OFFSET - 8; }
+    bool isImmediate() const { return bits_ && !isObject(); }
+    bool isInteger() const { return bits_ >= INT_TAG; }
+    bool isFloat() const { return bits_ >= DOUBLE_OFFSET && bits_ < INT_TAG; }
+    bool isNil() const { return bits_ == NIL_BITS; }
+    bool isTrue() const { return bits_ == TRUE_BITS; }
+    bool isFalse() const { return bits_ == FALSE_BITS; }
+
+    long long integerValue() const {
+        return static_cast<long long>(bits_ << 16) >> 16;
+    }
+    double floatValue() const {
+        std::uint64_t bits = bits_ - DOUBLE_OFFSET;
+        double val;
+        std::memcpy(&val, &bits, sizeof val);
+        return val;
+    }
+
+    // Type tag and is<T>() without boxing an immediate
+    inline TypeTag tag() const;
+    template<typename T>
+    bool is() const;
+
+    void swap(ObPtr& other) noexcept { std::swap(bits_, other.bits_); }
+    void reset() { ObPtr().swap(*this); }
+
+    Object* get() const { return isImmediate() ? box() : object(); }
+    Object& operator*() const { return *get(); }
+    Object* operator->() const { return get(); }
+    explicit operator bool() const { return bits_ != 0; }
+    inline long use_count() const;
+
+    // Identity: the same object, or the same immediate
+    bool operator==(const ObPtr& rhs) const { return bits_ == rhs.bits_; }
+    bool operator!=(const ObPtr& rhs) const { return bits_ != rhs.bits_; }
+    bool operator==(std::nullptr_t) const { return bits_ == 0; }
+    bool operator!=(std::nullptr_t) const { return bits_ != 0; }
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <functional>
+
+#include "pmap.h"
+#include "types.h"
+
+
+typedef PersistentMap::Entry Entry;
+typedef PersistentMap::Node Node;
+
+static constexpr unsigned BITS = PersistentMap::BITS;
+static constexpr unsigned HASH_BITS = PersistentMap::HASH_BITS;
+static constexpr std::size_t MASK = (std::size_t(1) << BITS) - 1;
+
+
+// Keys and values
+
+// Same as key->hash(), without boxing an immediate integer
+static std::size_t keyHash(const ObPtr& key) {
+    if (key.isInteger())
+        return std::hash<long long> {}(key.integerValue());
+    return key->hash();
+}
+
+static bool sameKey(const Entry& entry, const ObPtr& key, std::size_t hash) {
+    return entry.hash == hash && HashMapPred {}(entry.key, key);
+}
+
+// Values are equal as = has them, which also relates 1/2 and 0.5
+static bool sameValue(const ObPtr& lhs, const ObPtr& rhs) {
+    return lhs == rhs || truthy(comparison(CompareOp::Equal, lhs, rhs));
+}
+
+
+// Nodes
+
+static std::uint32_t bitFor(std::size_t hash, unsigned shift) {
+    return std::uint32_t(1) << ((hash >> shift) & MASK);
+}
+
+// Position of bit's item among the items of map
+static std::size_t indexOf(std::uint32_t map, std::uint32_t bit) {
+    return __builtin_popcount(map & (bit - 1));
+}
+
+static void release(Node* node) {
+    if (--node->refs)
+        return;
+    for (Node* child : node->children)
+        release(child);
+    delete node;
+}
+
+// Takes over a reference to node and returns a node with the same
+// contents that only the caller references
+static Node* editable(Node* node) {
+    if (node->refs == 1)
+        return node;
+    Node* copy = new Node(*node);
+    copy->refs = 1;
+    for (Node* child : copy->children)
+        child->refs++;
+    node->refs--;
+    return copy;
+}
+
+// A node holding two entries whose hashes agree below shift
+static Node* merge(Entry lhs, Entry rhs, unsigned shift) {
+    Node* node = new Node;
+    if (shift >= HASH_BITS) {
+        node->entries = { std::move(lhs), std::move(rhs) };
+        return node;
+    }
+    std::uint32_t lbit = bitFor(lhs.hash, shift);
+    std::uint32_t rbit = bitFor(rhs.hash, shift);
+    if (lbit == rbit) {
+        node->nodemap = lbit;
+        node->children.push_back(merge(std::move(lhs), std::move(rhs), shift + BITS));
+    } else {
+        node->datamap = lbit | rbit;
+        if (rbit < lbit)
+            std::swap(lhs, rhs);
+        node->entries = { std::move(lhs), std::move(rhs) };
+    }
+    return node;
+}
+
+// Takes over a reference to node and returns it with entry set
+static Node* setIn(Node* node, unsigned shift, Entry& entry, bool& added) {
+    node = editable(node);
+    if (shift >= HASH_BITS) {
+        for (Entry& e : node->entries)
+            if (sameKey(e, entry.key, entry.hash)) {
+                e.value = std::move(entry.value);
+                return node;
+            }
+        node->entries.push_back(std::move(entry));
+        added = true;
+        return node;
+    }
+    std::uint32_t bit = bitFor(entry.hash, shift);
+    if (node->datamap & bit) {
+        std::size_t i = indexOf(node->datamap, bit);
+        Entry& cur = node->entries[i];
+        if (sameKey(cur, entry.key, entry.hash)) {
+            cur.value = std::move(entry.value);
+            return node;
+        }
+        Node* child = merge(std::move(cur), std::move(entry), shift + BITS);
+        node->entries.erase(node->entries.begin() + i);
+        node->datamap ^= bit;
+        node->nodemap |= bit;
+        node->children.insert(node->children.begin() + indexOf(node->nodemap, bit), child);
+        added = true;
+    } else if (node->nodemap & bit) {
+        Node*& child = node->children[indexOf(node->nodemap, bit)];
+        child = setIn(child, shift + BITS, entry, added);
+    } else {
+        node->entries.insert(node->entries.begin() + indexOf(node->datamap, bit),
+                             std::move(entry));
+        node->datamap |= bit;
+        added = true;
+    }
+    return node;
+}
+
+// Takes over a reference to node and returns it without key, which it
+// holds. A child left with a single entry is folded into node.
+static Node* eraseIn(Node* node, unsigned shift, const ObPtr& key, std::size_t hash) {
+    node = editable(node);
+    if (shift >= HASH_BITS) {
+        auto it = std::find_if(node->entries.begin(), node->entries.end(),
+                [&](const Entry& e) { return sameKey(e, key, hash); });
+        node->entries.erase(it);
+        return node;
+    }
+    std::uint32_t bit = bitFor(hash, shift);
+    if (node->datamap & bit) {
+        node->entries.erase(node->entries.begin() + indexOf(node->datamap, bit));
+        node->datamap ^= bit;
+        return node;
+    }
+    std::size_t j = indexOf(node->nodemap, bit);
+    Node* child = eraseIn(node->children[j], shift + BITS, key, hash);
+    if (child->children.empty() && child->entries.size() == 1) {
+        node->entries.insert(node->entries.begin() + indexOf(node->datamap, bit),
+                             std::move(child->entries[0]));
+        node->datamap |= bit;
+        node->nodemap ^= bit;
+        node->children.erase(node->children.begin() + j);
+        release(child);
+    } else {
+        node->children[j] = child;
+    }
+    return node;
+}
+
+static bool equalNodes(const Node* lhs, const Node* rhs, unsigned shift) {
+    if (lhs == rhs)
+        return true;
+    if (shift >= HASH_BITS) {
+        // Collision nodes keep entries in insertion order
+        if (lhs->entries.size() != rhs->entries.size())
+            return false;
+        for (const Entry& l : lhs->entries) {
+            auto r = std::find_if(rhs->entries.begin(), rhs->entries.end(),
+                    [&](const Entry& e) { return sameKey(e, l.key, l.hash); });
+            if (r == rhs->entries.end() || !sameValue(l.value, r->value))
+                return false;
+        }
+        return true;
+    }
+    if (lhs->datamap != rhs->datamap || lhs->nodemap != rhs->nodemap)
+        return false;
+    for (std::size_t i = 0; i < lhs->entries.size(); i++) {
+        const Entry& l = lhs->entries[i];
+        const Entry& r = rhs->entries[i];
+        if (!sameKey(r, l.key, l.hash) || !sameValue(l.value, r.value))
+            return false;
+    }
+    for (std::size_t i = 0; i < lhs->children.size(); i++)
+        if (!equalNodes(lhs->children[i], rhs->children[i], shift + BITS))
+            return false;
+    return true;
+}
+
+
+// PersistentMap
+
+PersistentMap::PersistentMap(const PersistentMap& other)
+    : size_(other.size_), root_(other.root_) {
+    if (root_)
+        root_->refs++;
+}
+
+PersistentMap::PersistentMap(PersistentMap&& other) noexcept
+    : PersistentMap() {
+    swap(other);
+}
+
+PersistentMap& PersistentMap::operator=(PersistentMap other) noexcept {
+    swap(other);
+    return *this;
+}
+
+PersistentMap::~PersistentMap() {
+    if (root_)
+        release(root_);
+}
+
+void PersistentMap::swap(PersistentMap& other) noexcept {
+    std::swap(size_, other.size_);
+    std::swap(root_, other.root_);
+}
+
+const ObPtr* PersistentMap::find(const ObPtr& key) const {
+    std::size_t hash = keyHash(key);
+    const Node* node = root_;
+    for (unsigned shift = 0; node; shift += BITS) {
+        if (shift >= HASH_BITS) {
+            for (const Entry& e : node->entries)
+                if (sameKey(e, key, hash))
+                    return &e.value;
+            return nullptr;
+        }
+        std::uint32_t bit = bitFor(hash, shift);
+        if (node->datamap & bit) {
+            const Entry& e = node->entries[indexOf(node->datamap, bit)];
+            return sameKey(e, key, hash) ? &e.value : nullptr;
+        }
+        if (!(node->nodemap & bit))
+            return nullptr;
+        node = node->children[indexOf(node->nodemap, bit)];
+    }
+    return nullptr;
+}
+
+void PersistentMap::set(ObPtr key, ObPtr value) {
+    std::size_t hash = keyHash(key);
+    Entry entry { std::move(key), std::move(value), hash };
+    bool added = false;
+    root_ = setIn(root_ ? root_ : new Node, 0, entry, added);
+    if (added)
+        size_++;
+}
+
+void PersistentMap::erase(const ObPtr& key) {
+    if (!find(key))
+        return;
+    root_ = eraseIn(root_, 0, key, keyHash(key));
+    if (--size_ == 0) {
+        release(root_);
+        root_ = nullptr;
+    }
+}
+
+PersistentMap PersistentMap::assoc(ObPtr key, ObPtr value) const {
+    PersistentMap res(*this);
+    res.set(std::move(key), std::move(value));
+    return res;
+}
+
+PersistentMap PersistentMap::dissoc(const ObPtr& key) const {
+    PersistentMap res(*this);
+    res.erase(key);
+    return res;
+}
+
+bool PersistentMap::operator==(const PersistentMap& rhs) const {
+    if (size_ != rhs.size_)
+        return false;
+    return size_ == 0 || equalNodes(root_, rhs.root_, 0);
+}
+
+// Iterator
+
+void PersistentMap::Iterator::advance() {
+    while (depth_ >= 0) {
+        Frame& frame = stack_[depth_];
+        const Node* node = frame.node;
+        if (frame.next < node->entries.size()) {
+            cur_ = &node->entries[frame.next++];
+            return;
+        }
+        std::size_t child = frame.next++ - node->entries.size();
+        if (child < node->children.size())
+            stack_[++depth_] = Frame { node->children[child], 0 };
+        else
+            depth_--;
+    }
+    cur_ = nullptr;
+}
@@ -0,0 +1,146 @@
+#ifndef _PMAP_H_
+#define _PMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "obptr.h"
+
+
+// Persistent hash map: a hash array mapped trie. Each node takes 5 bits
+// of a key's hash and keeps, by those bits, entries and child nodes for
+// the keys that share them; keys whose whole hash is equal end up
+// together in a collision node. Like PersistentVector, updates copy the
+// path they change and share the rest, and nodes only one map references
+// are updated in place (see Builder).
+//
+// A node never holds a lone entry that could sit in its parent, so the
+// trie for a set of keys has one shape. Equal maps therefore have equal
+// bitmaps all the way down, and equality can stop at shared nodes.
+class PersistentMap {
+public:
+    static constexpr unsigned BITS = 5;
+    static constexpr unsigned HASH_BITS = 64;
+    // Nodes from the root to a collision node
+    static constexpr unsigned MAX_DEPTH = (HASH_BITS + BITS - 1) / BITS + 1;
+
+    struct Entry {
+        ObPtr key;
+        ObPtr value;
+        std::size_t hash;
+    };
+    struct Node;
+    class Iterator;
+    class Builder;
+
+private:
+    std::size_t size_;
+    // Null while empty
+    Node* root_;
+
+    void set(ObPtr key, ObPtr value);
+    void erase(const ObPtr& key);
+public:
+    PersistentMap() : size_(0), root_(nullptr) { };
+    PersistentMap(const PersistentMap& other);
+    PersistentMap(PersistentMap&& other) noexcept;
+    PersistentMap& operator=(PersistentMap other) noexcept;
+    ~PersistentMap();
+
+    void swap(PersistentMap& other) noexcept;
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // The value stored for key, or null
+    const ObPtr* find(const ObPtr& key) const;
+
+    // This map with key bound to value
+    PersistentMap assoc(ObPtr key, ObPtr value) const;
+    // This map without key
+    PersistentMap dissoc(const ObPtr& key) const;
+
+    inline Iterator begin() const;
+    inline Iterator end() const;
+
+    // The node this map holds, for following its references
+    const Node* root() const { return root_; }
+
+    // Same keys bound to equal values. Nodes both maps share are skipped.
+    bool operator==(const PersistentMap& rhs) const;
+    // Whether other is this map or a copy of it
+    bool sameAs(const PersistentMap& other) const {
+        return root_ == other.root_;
+    }
+};
+
+
+struct PersistentMap::Node {
+    unsigned refs = 1;
+    // Hash bits that select an entry, and those that select a child
+    std::uint32_t datamap = 0;
+    std::uint32_t nodemap = 0;
+    // In hash bits order. A collision node has only entries.
+    std::vector<Entry> entries;
+    std::vector<Node*> children;
+};
+
+
+// Visits the entries of each node, then its children
+class PersistentMap::Iterator {
+    struct Frame {
+        const Node* node;
+        // Entries first, then children
+        std::size_t next;
+    };
+
+    Frame stack_[MAX_DEPTH];
+    int depth_;
+    const Entry* cur_;
+
+    void advance();
+public:
+    explicit Iterator(const Node* root) : depth_(-1), cur_(nullptr) {
+        if (root) {
+            stack_[++depth_] = Frame { root, 0 };
+            advance();
+        }
+    }
+
+    const Entry& operator*() const { return *cur_; }
+    const Entry* operator->() const { return cur_; }
+    Iterator& operator++() {
+        advance();
+        return *this;
+    }
+    bool operator==(const Iterator& rhs) const { return cur_ == rhs.cur_; }
+    bool operator!=(const Iterator& rhs) const { return cur_ != rhs.cur_; }
+};
+
+PersistentMap::Iterator PersistentMap::begin() const {
+    return Iterator(root_);
+}
+
+PersistentMap::Iterator PersistentMap::end() const {
+    return Iterator(nullptr);
+}
+
+
+// Builds a map in place, as PersistentVector::Builder does a vector
+class PersistentMap::Builder {
+    PersistentMap map_;
+public:
+    Builder() { };
+    // Continues from a map; shared nodes are copied when first changed
+    explicit Builder(PersistentMap from) : map_(std::move(from)) { };
+
+    void set(ObPtr key, ObPtr value) { map_.set(std::move(key), std::move(value)); }
+    void erase(const ObPtr& key) { map_.erase(key); }
+    std::size_t size() const { return map_.size(); }
+
+    // The map built so far; the builder is left empty
+    PersistentMap persistent() { return std::move(map_); }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include <algorithm>
+
+#include "pvector.h"
+#include "types.h"
+
+
+typedef PersistentVector::Node Node;
+typedef PersistentVector::Leaf Leaf;
+typedef PersistentVector::Branch Branch;
+
+static constexpr unsigned BITS = PersistentVector::BITS;
+static constexpr std::size_t WIDTH = PersistentVector::WIDTH;
+static constexpr std::size_t MASK = PersistentVector::MASK;
+
+
+// Nodes
+
+static void retain(Node* node) {
+    if (node)
+        node->refs++;
+}
+
+static void release(Node* node) {
+    if (!node || --node->refs)
+        return;
+    if (node->leaf) {
+        delete static_cast<Leaf*>(node);
+    } else {
+        Branch* branch = static_cast<Branch*>(node);
+        for (Node* child : branch->children)
+            release(child);
+        delete branch;
+    }
+}
+
+// Takes over a reference to leaf and returns a leaf with the same first
+// count values that only the caller references
+static Leaf* editable(Leaf* leaf, std::size_t count) {
+    if (leaf->refs == 1) {
+        // Values past count were appended by vectors that are gone
+        for (std::size_t i = count; i < leaf->filled; i++)
+            leaf->values[i].reset();
+        leaf->filled = count;
+        return leaf;
+    }
+    Leaf* copy = new Leaf;
+    std::copy(leaf->values, leaf->values + count, copy->values);
+    copy->filled = count;
+    leaf->refs--;
+    return copy;
+}
+
+static Branch* editable(Branch* branch) {
+    if (branch->refs == 1)
+        return branch;
+    Branch* copy = new Branch;
+    std::copy(branch->children, branch->children + WIDTH, copy->children);
+    for (Node* child : copy->children)
+        retain(child);
+    branch->refs--;
+    return copy;
+}
+
+// A chain of new branches down to leaf, to hang at level
+static Node* newPath(unsigned level, Leaf* leaf) {
+    if (level == 0)
+        return leaf;
+    Branch* branch = new Branch;
+    branch->children[0] = newPath(level - BITS, leaf);
+    return branch;
+}
+
+static Node* assocIn(Node* node, unsigned level, std::size_t i, ObPtr value) {
+    if (level == 0) {
+        Leaf* leaf = editable(static_cast<Leaf*>(node), WIDTH);
+        leaf->values[i & MASK] = std::move(value);
+        return leaf;
+    }
+    Branch* branch = editable(static_cast<Branch*>(node));
+    Node*& child = branch->children[(i >> level) & MASK];
+    child = assocIn(child, level - BITS, i, std::move(value));
+    return branch;
+}
+
+
+// PersistentVector
+
+PersistentVector::PersistentVector(const PersistentVector& other)
+    : size_(other.size_), shift_(other.shift_), root_(other.root_), tail_(other.tail_) {
+    retain(root_);
+    retain(tail_);
+}
+
+PersistentVector::PersistentVector(PersistentVector&& other) noexcept
+    : PersistentVector() {
+    swap(other);
+}
+
+PersistentVector& PersistentVector::operator=(PersistentVector other) noexcept {
+    swap(other);
+    return *this;
+}
+
+PersistentVector::~PersistentVector() {
+    release(root_);
+    release(tail_);
+}
+
+void PersistentVector::swap(PersistentVector& other) noexcept {
+    std::swap(size_, other.size_);
+    std::swap(shift_, other.shift_);
+    std::swap(root_, other.root_);
+    std::swap(tail_, other.tail_);
+}
+
+// Takes over a reference to node, which may be shared, and returns the
+// root of a trie that also holds leaf at the next index after size_ - 1
+Branch* PersistentVector::pushTail(Branch* node, unsigned level, Leaf* leaf) {
+    Branch* branch = editable(node);
+    Node*& child = branch->children[((size_ - 1) >> level) & MASK];
+    if (level == BITS)
+        child = leaf;
+    else if (child)
+        child = pushTail(static_cast<Branch*>(child), level - BITS, leaf);
+    else
+        child = newPath(level - BITS, leaf);
+    return branch;
+}
+
+void PersistentVector::push(ObPtr value) {
+    std::size_t tailCount = size_ - tailOffset();
+    if (!tail_) {
+        tail_ = new Leaf;
+    } else if (tailCount == WIDTH) {
+        // The full tail moves into the trie along with our reference
+        if (!root_) {
+            root_ = new Branch;
+            root_->children[0] = tail_;
+        } else if ((size_ >> BITS) > (std::size_t(1) << shift_)) {
+            Branch* top = new Branch;
+            top->children[0] = root_;
+            top->children[1] = newPath(shift_, tail_);
+            root_ = top;
+            shift_ += BITS;
+        } else {
+            root_ = pushTail(root_, shift_, tail_);
+        }
+        tail_ = new Leaf;
+        tailCount = 0;
+    } else if (tail_->refs == 1 || tail_->filled != tailCount) {
+        tail_ = editable(tail_, tailCount);
+    }
+    tail_->values[tailCount] = std::move(value);
+    tail_->filled = tailCount + 1;
+    size_++;
+}
+
+void PersistentVector::set(std::size_t i, ObPtr value) {
+    if (i == size_) {
+        push(std::move(value));
+    } else if (i >= tailOffset()) {
+        tail_ = editable(tail_, size_ - tailOffset());
+        tail_->values[i & MASK] = std::move(value);
+    } else {
+        root_ = static_cast<Branch*>(assocIn(root_, shift_, i, std::move(value)));
+    }
+}
+
+PersistentVector PersistentVector::conj(ObPtr value) const {
+    PersistentVector res(*this);
+    res.push(std::move(value));
+    return res;
+}
+
+PersistentVector PersistentVector::assoc(std::size_t i, ObPtr value) const {
+    PersistentVector res(*this);
+    res.set(i, std::move(value));
+    return res;
+}
@@ -0,0 +1,129 @@
+#ifndef _PVECTOR_H_
+#define _PVECTOR_H_
+
+#include <cstddef>
+
+#include "obptr.h"
+
+
+// Persistent vector: a trie of 32-way nodes holding the elements in
+// whole leaves of 32, and a tail leaf holding the last 1 to 32. Updates
+// copy the nodes on the path they change and share the rest with the
+// vector they were made from, so nth and assoc are O(log32 n) and conj
+// is amortised O(1).
+//
+// Nodes are counted like Objects. A node only this vector references is
+// updated in place rather than copied, which makes a vector that nothing
+// else has seen (see Builder) a transient for free.
+class PersistentVector {
+public:
+    static constexpr unsigned BITS = 5;
+    static constexpr std::size_t WIDTH = std::size_t(1) << BITS;
+    static constexpr std::size_t MASK = WIDTH - 1;
+
+    struct Node;
+    struct Leaf;
+    struct Branch;
+    class Builder;
+
+private:
+    std::size_t size_;
+    // A node at level L indexes its children with bits L..L+4 of the
+    // index; leaves are at level 0
+    unsigned shift_;
+    // Null until the first leaf is full
+    Branch* root_;
+    // Null while empty
+    Leaf* tail_;
+
+    std::size_t tailOffset() const {
+        return size_ <= WIDTH ? 0 : (size_ - 1) & ~MASK;
+    }
+    void push(ObPtr value);
+    void set(std::size_t i, ObPtr value);
+    Branch* pushTail(Branch* node, unsigned level, Leaf* leaf);
+public:
+    PersistentVector() : size_(0), shift_(BITS), root_(nullptr), tail_(nullptr) { };
+    PersistentVector(const PersistentVector& other);
+    PersistentVector(PersistentVector&& other) noexcept;
+    PersistentVector& operator=(PersistentVector other) noexcept;
+    ~PersistentVector();
+
+    void swap(PersistentVector& other) noexcept;
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // i < size()
+    const ObPtr& operator[](std::size_t i) const { return leafFor(i)[i & MASK]; }
+    // The elements of the leaf holding i, indexed by i & MASK; i < size()
+    inline const ObPtr* leafFor(std::size_t i) const;
+
+    // This vector with value appended
+    PersistentVector conj(ObPtr value) const;
+    // This vector with element i replaced, or with value appended if i
+    // is size(); i <= size()
+    PersistentVector assoc(std::size_t i, ObPtr value) const;
+
+    // The nodes this vector holds, for following its references
+    const Branch* root() const { return root_; }
+    const Leaf* tail() const { return tail_; }
+
+    // Whether other is this vector or a copy of it
+    bool sameAs(const PersistentVector& other) const {
+        return size_ == other.size_ && root_ == other.root_ && tail_ == other.tail_;
+    }
+};
+
+
+struct PersistentVector::Node {
+    unsigned refs = 1;
+    bool leaf;
+    // Leaf slots holding values. A tail shared by vectors of different
+    // sizes is appended to in place by the one whose size reaches it.
+    unsigned char filled = 0;
+
+    explicit Node(bool leaf) : leaf(leaf) { };
+};
+
+struct PersistentVector::Leaf : PersistentVector::Node {
+    ObPtr values[WIDTH];
+
+    Leaf() : Node(true) { };
+};
+
+struct PersistentVector::Branch : PersistentVector::Node {
+    Node* children[WIDTH] = {};
+
+    Branch() : Node(false) { };
+};
+
+const ObPtr* PersistentVector::leafFor(std::size_t i) const {
+    if (i >= tailOffset())
+        return tail_->values;
+    const Node* node = root_;
+    for (unsigned level = shift_; level > 0; level -= BITS)
+        node = static_cast<const Branch*>(node)->children[(i >> level) & MASK];
+    return static_cast<const Leaf*>(node)->values;
+}
+
+
+// Builds a vector by appending in place. The nodes it creates are
+// referenced by nothing else until persistent() hands them over, so
+// each push only writes to the tail, and to one path once per leaf.
+class PersistentVector::Builder {
+    PersistentVector vec_;
+public:
+    Builder() { };
+    // Continues from a vector; shared nodes are copied when first changed
+    explicit Builder(PersistentVector from) : vec_(std::move(from)) { };
+
+    void push(ObPtr value) { vec_.push(std::move(value)); }
+    void set(std::size_t i, ObPtr value) { vec_.set(i, std::move(value)); }
+    std::size_t size() const { return vec_.size(); }
+
+    // The vector built so far; the builder is left empty
+    PersistentVector persistent() { return std::move(vec_); }
+};
+
+#endif
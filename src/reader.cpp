@@ -1,40 +1,177 @@
-#include <vector>
+#include <charconv>
 #include <string>
-#include <boost/regex.hpp>
+#include <string_view>
+#include <vector>
 
+#include "arena.h"
 #include "exceptions.h"
 #include "reader.h"
 #include "types.h"
 
 
-std::vector<std::string> tokenize(const std::string& line) {
-    std::vector<std::string> result;
-    boost::smatch match;
+static const ObPtr QUOTE_SYM = newSymbol("quote");
+static const ObPtr QUASIQUOTE_SYM = newSymbol("quasiquote");
+static const ObPtr SPLICE_UNQUOTE_SYM = newSymbol("splice-unquote");
+static const ObPtr UNQUOTE_SYM = newSymbol("unquote");
+static const ObPtr DEREF_SYM = newSymbol("deref");
+
+static bool isWhitespace(char c) {
+    switch (c) {
+        case ' ': case '\t': case '\n': case '\r': case '\f': case '\v':
+        case ',':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Characters that end a symbol or number token
+static bool isDelimiter(char c) {
+    switch (c) {
+        case '[': case ']': case '{': case '}': case '(': case ')':
+        case '\'': case '"': case '`': case ';':
+            return true;
+        default:
+            return isWhitespace(c);
+    }
+}
+
+// Splits the line in a single pass. Tokens are views into `line`, which
+// must outlive them.
+std::vector<std::string_view> tokenize(std::string_view line) {
+    std::vector<std::string_view> result;
+    const char* pos = line.data();
+    const char* end = pos + line.size();
 
-    auto itBegin = line.cbegin();
-    auto itEnd = line.cend();
+    for (;;) {
+        while (pos != end && isWhitespace(*pos))
+            pos++;
+        if (pos == end)
+            break;
 
-    while (itBegin != itEnd) {
-        if (boost::regex_search(itBegin, itEnd, match, TOKENS_REGEXP)) {
-            std::string token = match[1].str();
-            result.push_back(token);
-            itBegin += match[0].str().size();
+        const char* begin = pos;
+        switch (*pos++) {
+            case '~':
+                if (pos != end && *pos == '@')
+                    pos++;
+                break;
+            case '[': case ']': case '{': case '}': case '(': case ')':
+            case '\'': case '`': case '^': case '@': case ';':
+                break;
+            case '"':
+                while (pos != end && *pos != '"') {
+                    if (*pos == '\\' && pos + 1 != end)
+                        pos++;
+                    pos++;
+                }
+                if (pos != end)
+                    pos++;
+                break;
+            default:
+                while (pos != end && !isDelimiter(*pos))
+                    pos++;
         }
+        result.emplace_back(begin, pos - begin);
     }
     return result;
 }
 
+// Tracks bracket depth and open strings over `line`
+void FormStream::scan(const std::string& line) {
+    for (std::size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (inString_) {
+            if (c == '\\')
+                i++;
+            else if (c == '"')
+                inString_ = false;
+        } else if (c == '"')
+            inString_ = true;
+        else if (c == '(' || c == '[' || c == '{')
+            depth_++;
+        else if (c == ')' || c == ']' || c == '}')
+            depth_--;
+    }
+}
+
+// Whether pending_ holds only whole forms: brackets and strings are
+// closed and it does not end with a quote waiting for its form.
+bool FormStream::complete() const {
+    if (depth_ > 0 || inString_)
+        return false;
+    auto last = pending_.find_last_not_of(" \t\n\r\f\v,");
+    if (last == std::string::npos)
+        return true;
+    switch (pending_[last]) {
+        case '\'': case '`': case '~': case '@': case '^':
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Returns the next form, or nullptr at the end of the stream
+ObPtr FormStream::next() {
+    while (reader_.eof()) {
+        pending_.clear();
+        depth_ = 0;
+        inString_ = false;
+        std::string line;
+        do {
+            if (!std::getline(in_, line))
+                break;
+            pending_ += line;
+            pending_ += '\n';
+            scan(line);
+        } while (!complete());
+        if (pending_.empty())
+            return nullptr;
+        reader_ = Reader(tokenize(pending_));
+    }
+    try {
+        return readTopLevel(reader_);
+    } catch (...) {
+        // The rest of a malformed chunk can't be read reliably
+        reader_ = Reader({ });
+        throw;
+    }
+}
+
 ObPtr readStr(const std::string& line) {
-    std::vector<std::string> tokens = tokenize(line);
-    Reader reader = Reader(tokens);
-    return readForm(reader);
+    Reader reader(tokenize(line));
+    return readTopLevel(reader);
+}
+
+ObPtr readTopLevel(Reader& reader) {
+    Arena* arena = Arena::create();
+    reader.setArena(arena);
+    try {
+        ObPtr form = readForm(reader);
+        reader.setArena(nullptr);
+        arena->seal();
+        return form;
+    } catch (...) {
+        reader.items().clear();
+        reader.setArena(nullptr);
+        arena->seal();
+        throw;
+    }
+}
+
+// Builds a T from the items pushed since mark and pops them
+template<typename T>
+static ObPtr collect(Reader& reader, std::size_t mark) {
+    std::vector<ObPtr>& items = reader.items();
+    ObPtr seq = arenaNew<T>(reader.arena(), items.cbegin() + mark, items.cend());
+    items.resize(mark);
+    return seq;
 }
 
 ObPtr readForm(Reader& reader) {
     if (reader.eof())
         return newNil();
 
-    std::string token = reader.peek();
+    std::string_view token = reader.peek();
     switch (token[0]) {
         case '(':
             reader.next();
@@ -59,62 +196,112 @@ ObPtr readForm(Reader& reader) {
 }
 
 ObPtr readList(Reader& reader) {
-    ObPtr list = newList();
+    std::size_t mark = reader.items().size();
     while (!reader.eof()) {
         if (reader.peek()[0] == ')') {
             reader.next();
-            return list;
+            return collect<List>(reader, mark);
+        }
+        else {
+            ObPtr item = readForm(reader);
+            reader.items().push_back(std::move(item));
         }
-        else
-            list->as<List>()->push(readForm(reader));
     }
-    if (reader.eof())
-        throw SyntaxError("'(' never closed");
-    return list;
+    throw SyntaxError("'(' never closed");
 }
 
 ObPtr readVector(Reader& reader) {
-    ObPtr vector = newVector();
+    std::size_t mark = reader.items().size();
     while (!reader.eof()) {
         if (reader.peek()[0] == ']') {
             reader.next();
-            return vector;
+            return collect<Vector>(reader, mark);
+        }
+        else {
+            ObPtr item = readForm(reader);
+            reader.items().push_back(std::move(item));
         }
-        else
-            vector->as<Vector>()->push(readForm(reader));
     }
-    if (reader.eof())
-        throw SyntaxError("']' never closed");
-    return vector;
+    throw SyntaxError("']' never closed");
 }
 
+// Length of the run of decimal digits at the start of `token`
+static std::size_t digitsAt(std::string_view token, std::size_t pos) {
+    std::size_t begin = pos;
+    while (pos < token.size() && token[pos] >= '0' && token[pos] <= '9')
+        pos++;
+    return pos - begin;
+}
+
+static std::size_t signAt(std::string_view token) {
+    return !token.empty() && (token[0] == '+' || token[0] == '-');
+}
+
+template<typename T>
+static T parseNumber(std::string_view token, std::string_view digits) {
+    // from_chars accepts a leading '-' but not '+'
+    if (!digits.empty() && digits[0] == '+')
+        digits.remove_prefix(1);
+    T value;
+    auto [end, err] = std::from_chars(digits.data(),
+                                      digits.data() + digits.size(), value);
+    if (err == std::errc::result_out_of_range)
+        throw OutOfRange(std::string(token) + " too long");
+    if (err != std::errc() || end != digits.data() + digits.size())
+        throw SyntaxError(std::string(token));
+    return value;
+}
+
+// Whether [+-]digits is in the range of long long; longer integers are
+// read as BigIntegers
+static bool fitsLongLong(std::string_view digits) {
+    if (!digits.empty() && digits[0] == '+')
+        digits.remove_prefix(1);
+    long long value;
+    auto res = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+    return res.ec != std::errc::result_out_of_range;
+}
+
+// Numbers are [+-]digits, [+-]digits/digits and [+-](digits.[digits] |
+// .digits); anything else is a symbol.
 ObPtr readAtom(Reader& reader) {
-    std::string token = reader.next();
-    boost::smatch match;
-    if (boost::regex_search(token, match, rationalRegex)) {
-        try {
-            long long num = std::stoll(match[1].str());
-            long long den = std::stoll(match[2].str());
-            return newRational(num, den);
-        } catch (const std::out_of_range& e) {
-            throw OutOfRange(token + " too long");
-        }
+    std::string_view token = reader.next();
+    std::size_t sign = signAt(token);
+    std::size_t intDigits = digitsAt(token, sign);
+    std::size_t pos = sign + intDigits;
+
+    if (intDigits > 0 && pos == token.size()) {
+        if (!fitsLongLong(token))
+            return arenaNew<BigInteger>(reader.arena(), BigInt::parse(token));
+        long long value = parseNumber<long long>(token, token);
+        if (value >= ObPtr::IMMEDIATE_MIN && value <= ObPtr::IMMEDIATE_MAX)
+            return newInteger(value);
+        return arenaNew<Integer>(reader.arena(), value);
     }
-    else if (boost::regex_match(token, floatRegex))
-        return newFloat(std::stod(token));
-    else if (boost::regex_match(token, intRegex)) {
-        try {
-            return newInteger(std::stoll(token));
-        }
-        catch (const std::out_of_range& e) {
-            throw OutOfRange(token + " too long");
+    if (intDigits > 0 && token[pos] == '/') {
+        std::size_t denDigits = digitsAt(token, pos + 1);
+        if (denDigits > 0 && pos + 1 + denDigits == token.size()) {
+            std::string_view numPart = token.substr(0, pos);
+            std::string_view denPart = token.substr(pos + 1);
+            if (!fitsLongLong(numPart) || !fitsLongLong(denPart))
+                return arenaNew<Rational>(reader.arena(), BigInt::parse(numPart),
+                                          BigInt::parse(denPart));
+            long long num = parseNumber<long long>(token, numPart);
+            long long den = parseNumber<long long>(token, denPart);
+            return arenaNew<Rational>(reader.arena(), num, den);
         }
     }
+    if (pos < token.size() && token[pos] == '.') {
+        std::size_t fracDigits = digitsAt(token, pos + 1);
+        if ((intDigits > 0 || fracDigits > 0) &&
+                pos + 1 + fracDigits == token.size())
+            return newFloat(parseNumber<double>(token, token));
+    }
     return newSymbol(token);
 }
 
 ObPtr readHashMap(Reader& reader) {
-    ObPtr map = newHashMap();
+    ObPtr map = arenaNew<HashMap>(reader.arena());
     while (!reader.eof()) {
         if (reader.peek()[0] == '}') {
             reader.next();
@@ -130,41 +317,28 @@ ObPtr readHashMap(Reader& reader) {
     return map;
 }
 
+// (sym form) for the form after a quote token
+static ObPtr quote(Reader& reader, const ObPtr& sym) {
+    ObPtr form = readForm(reader);
+    std::size_t mark = reader.items().size();
+    reader.items().push_back(sym);
+    reader.items().push_back(std::move(form));
+    return collect<List>(reader, mark);
+}
+
 ObPtr readQuotedValue(Reader& reader) {
-    std::string token = reader.next();
+    std::string_view token = reader.next();
     switch (token[0]) {
-        case '\'': {
-            ObPtr list = newList();
-            list->as<List>()->push(newSymbol("quote"));
-            list->as<List>()->push(readForm(reader));
-            return list;
-        }
-        case '`': {
-            ObPtr list = newList();
-            list->as<List>()->push(newSymbol("quasiquote"));
-            list->as<List>()->push(readForm(reader));
-            return list;
-        }
-        case '~': {
-            if (token.length() > 1 && token[1] == '@') {
-                ObPtr list = newList();
-                list->as<List>()->push(newSymbol("splice-unquote"));
-                list->as<List>()->push(readForm(reader));
-                return list;
-            }
-            else {
-                ObPtr list = newList();
-                list->as<List>()->push(newSymbol("unquote"));
-                list->as<List>()->push(readForm(reader));
-                return list;
-            }
-        }
-        case '@': {
-            ObPtr list = newList();
-            list->as<List>()->push(newSymbol("deref"));
-            list->as<List>()->push(readForm(reader));
-            return list;
-        }
+        case '\'':
+            return quote(reader, QUOTE_SYM);
+        case '`':
+            return quote(reader, QUASIQUOTE_SYM);
+        case '~':
+            if (token.length() > 1 && token[1] == '@')
+                return quote(reader, SPLICE_UNQUOTE_SYM);
+            return quote(reader, UNQUOTE_SYM);
+        case '@':
+            return quote(reader, DEREF_SYM);
         default:
             throw SyntaxError("Bad quote");
     }
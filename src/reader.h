@@ -2,52 +2,63 @@
 #define _READER_H_
 
 #include <iostream>
+#include <istream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <boost/regex.hpp>
 
+#include "arena.h"
 #include "types.h"
 
 
-// static const boost::regex WHITESPACES = boost::regex("[\\s,]*");
-
-// static const boost::regex VAlID_TOKENS_REGEXP[] = {
-//     boost::regex("~@"),
-//     boost::regex("[\\[\\]{}()'`~^@]"),
-//     boost::regex("\"(?:\\\\.|[^\\\\\"])*\""),
-//     boost::regex(";.*"),
-//     boost::regex("[^\\s\\[\\]{}('\"`,;)]*")
-// };
-
-static const boost::regex intRegex("^[-+]?\\d+$");
-static const boost::regex floatRegex("[+-]?([0-9]+[.]([0-9]*)?|[.][0-9]+)");
-static const boost::regex rationalRegex("([+-]?\\d+)/(\\d+)");
-
-static const boost::regex TOKENS_REGEXP(
-    "[\\s,]"
-    "*(~@|[\\[\\]{}()'`~^@]|"
-    "\"(?:\\\\.|[^\\\\\"])*\"?|"
-    // ";.*|"
-    ";|"
-    "[^\\s\\[\\]{}('\"`,;)]*)"
-);
-
-
 class Reader
 {
-    std::vector<std::string> tokens_;
+    std::vector<std::string_view> tokens_;
     unsigned pos_;
+    Arena* arena_;
+    std::vector<ObPtr> items_;
 public:
-    Reader(std::vector<std::string>& tokens) : tokens_(tokens), pos_(0) { };
-    std::string& next() { return tokens_[pos_++]; }
-    const std::string& peek() const { return tokens_[pos_]; }
+    Reader(std::vector<std::string_view> tokens)
+        : tokens_(std::move(tokens)), pos_(0), arena_(nullptr) { };
+    std::string_view next() { return tokens_[pos_++]; }
+    std::string_view peek() const { return tokens_[pos_]; }
     bool eof() const { return pos_ == tokens_.size(); }
+
+    // Arena of the form being read, nullptr to build on the heap
+    Arena* arena() const { return arena_; }
+    void setArena(Arena* arena) { arena_ = arena; }
+    // Elements of the sequences being read, innermost last, so each
+    // sequence is built once at its full size
+    std::vector<ObPtr>& items() { return items_; }
+};
+
+
+// Reads top-level forms one at a time from a stream. Input is pulled in
+// line by line, and only until the forms read so far are complete, so a
+// form may span many lines and the whole stream is never held in memory.
+class FormStream
+{
+    std::istream& in_;
+    std::string pending_;
+    Reader reader_;
+    int depth_;
+    bool inString_;
+
+    void scan(const std::string& line);
+    bool complete() const;
+public:
+    FormStream(std::istream& in)
+        : in_(in), reader_({ }), depth_(0), inString_(false) { };
+    ObPtr next();
 };
 
 
 ObPtr readStr(const std::string& line);
 
-std::vector<std::string> tokenize(const std::string& line);
+// Reads a form into a fresh arena, which is sealed once the form is read
+ObPtr readTopLevel(Reader& reader);
+
+std::vector<std::string_view> tokenize(std::string_view line);
 
 ObPtr readForm(Reader& reader);
 
@@ -1,115 +1,206 @@
+#include <algorithm>
+
+#include "arena.h"
 #include "repl.h"
+#include "resolver.h"
+#include "vm.h"
+
+
+const ObPtr DEF_SYM = newSymbol("def!");
+const ObPtr LET_SYM = newSymbol("let*");
+const ObPtr DO_SYM = newSymbol("do");
+const ObPtr IF_SYM = newSymbol("if");
+const ObPtr FN_SYM = newSymbol("fn*");
 
+// Evaluated arguments of the calls in progress. A call pushes its
+// arguments above those of the calls it is nested in and drops them when
+// it is done, so once the stack has grown calls allocate nothing for
+// them. Native functions do not evaluate, so the region a call passes
+// on is not moved while the call runs.
+static std::vector<ObPtr> argStack;
+
+class ArgFrame {
+    std::size_t base_;
+public:
+    ArgFrame() : base_(argStack.size()) { };
+    ~ArgFrame() { argStack.resize(base_); }
+    ArgFrame(const ArgFrame&) = delete;
+    ArgFrame& operator=(const ArgFrame&) = delete;
+
+    std::size_t base() const { return base_; }
+    Args args() const {
+        return Args(argStack.data() + base_, argStack.size() - base_);
+    }
+};
 
 ObPtr READ(std::string input) {
     return readStr(input);
 }
 
-ObPtr EVAL(ObPtr ast, Env& env) {
-    if (!ast->is<List>())
-        return evalAst(ast, env);
-    else if (ast->as<List>()->empty())
-        return ast;
-    else {
+// Forms in tail position (if branches, the last form of do, the let*
+// body and closure bodies) rebind ast and env and loop instead of
+// recursing, so tail calls run in constant native stack space.
+ObPtr EVAL(ObPtr ast, EnvPtr env) {
+    for (;;) {
+        if (ast.is<LetForm>()) {
+            const LetForm* let = ast->as<LetForm>();
+            EnvPtr newEnv = std::make_shared<Env>(env, let->names());
+            for (std::size_t i = 0; i < let->inits().size(); i++)
+                newEnv->slots_[let->slots()[i]] = EVAL(let->inits()[i], newEnv);
+            ast = let->body();
+            env = newEnv;
+            continue;
+        } else if (ast.is<FnForm>()) {
+            const FnForm* fn = ast->as<FnForm>();
+            return newClosure(fn->params(), fn->body(), env, fn->names());
+        } else if (!ast.is<List>())
+            return evalAst(ast, env);
+        else if (ast->as<List>()->empty())
+            return ast;
+
         List* list = ast->as<List>();
         ObPtr first = list->at(0);
-        if (first->is<Symbol>()) {
-            Symbol* special = first->as<Symbol>();
-            if (special->matches("def!")) {
-                try {
-                    ObPtr key = list->at(1);
-                    ObPtr value = EVAL(list->at(2), env);
-                    env.set(key, value);
-                    return value; // CHECK IT!!
-                }
-                catch (const std::out_of_range& e) {
-                    throw SyntaxError(list->repr());
-                }
+        if (first == DEF_SYM) {
+            try {
+                ObPtr key = list->at(1);
+                // Definitions hold the result, not a deferred expression,
+                // and do not pin the arena of the form it was read from
+                ObPtr value = promote(forceLazy(EVAL(list->at(2), env)));
+                if (key.is<LocalRef>())
+                    env->slots_[key->as<LocalRef>()->slot()] = value;
+                else
+                    env->set(key, value);
+                return value; // CHECK IT!!
             }
-            else if (special->matches("let*")) {
-                if (list->size() != 3)
-                    throw SyntaxError(list->repr());
-
-                ObPtr bindings(list->at(1));
-                if (bindings->as<Sequence>()->size() % 2 != 0)
-                    throw SyntaxError(bindings->repr());
-
-                Sequence* binds = bindings->as<Sequence>();
-                Env newEnv(&env);
-                for (int i = 0; i < binds->size(); i += 2) {
-                    ObPtr key = binds->at(i);
-                    ObPtr value = EVAL(binds->at(i + 1), newEnv);
-                    newEnv.set(key, value);
-                }
-                return EVAL(list->at(2), newEnv);
-            } else if (special->matches("do")) {
-                ObPtr result = newNil();
-                for (int i = 1; i < list->size(); i++)
-                    result = EVAL(list->at(i), env);
-                return result;
-
-            } else if (special->matches("if")) {
-                try {
-                    ObPtr condition = list->at(1);
-                    ObPtr trueExpr = list->at(2);
-                    ObPtr falseExpr = list->size() == 4 ?
-                        list->at(3) : newNil();
-                    if (*EVAL(condition, env))
-                        return EVAL(trueExpr, env);
-                    else
-                        return EVAL(falseExpr, env);
-                } catch (const std::out_of_range& e) {
-                    throw SyntaxError(
-                        "if (condition) (true_expr) [(false_expr)]"
-                    );
-                }
+            catch (const std::out_of_range& e) {
+                throw SyntaxError(list->repr());
             }
-            else if (special->matches("fn*")) {
-                try {
-                    ObPtr binds(list->at(1));
-                    ObPtr body(list->at(2));
-                    auto closure = [binds, body](std::vector<ObPtr> args, const Env& env = nullptr) {
-                        ObPtr exprs = newList(args.cbegin(), args.cend());
-                        Env newEnv(&env, binds, exprs);
-                        return EVAL(body, newEnv);
-                    };
-                    return newFn(closure);
-                } catch (const std::out_of_range& e) {
-                    throw SyntaxError("fn* (args) (body)");
-                }
+        }
+        else if (first == LET_SYM) {
+            if (list->size() != 3)
+                throw SyntaxError(list->repr());
+
+            ObPtr bindings(list->at(1));
+            if (bindings->as<Sequence>()->size() % 2 != 0)
+                throw SyntaxError(bindings->repr());
+
+            Sequence* binds = bindings->as<Sequence>();
+            EnvPtr newEnv(new Env(env));
+            for (int i = 0; i < binds->size(); i += 2) {
+                ObPtr key = binds->at(i);
+                ObPtr value = EVAL(binds->at(i + 1), newEnv);
+                newEnv->set(key, value);
+            }
+            ast = list->at(2);
+            env = newEnv;
+            continue;
+        } else if (first == DO_SYM) {
+            if (list->size() == 1)
+                return newNil();
+            for (int i = 1; i < list->size() - 1; i++)
+                EVAL(list->at(i), env);
+            ast = list->at(list->size() - 1);
+            continue;
+        } else if (first == IF_SYM) {
+            try {
+                ObPtr condition = list->at(1);
+                ObPtr trueExpr = list->at(2);
+                ObPtr falseExpr = list->size() == 4 ?
+                    list->at(3) : newNil();
+                if (truthy(EVAL(condition, env)))
+                    ast = trueExpr;
+                else
+                    ast = falseExpr;
+                continue;
+            } catch (const std::out_of_range& e) {
+                throw SyntaxError(
+                    "if (condition) (true_expr) [(false_expr)]"
+                );
+            }
+        }
+        else if (first == FN_SYM) {
+            try {
+                return newClosure(list->at(1), list->at(2), env);
+            } catch (const std::out_of_range& e) {
+                throw SyntaxError("fn* (args) (body)");
             }
         }
-        ObPtr term(evalAst(ast, env));
-        List* evalList = term->as<List>();
-        ObPtr evalFirst = evalList->at(0);
-        if (evalFirst->is<Fn>()) {
-            std::vector<ObPtr> args(evalList->begin() + 1, evalList->end());
-            return (*evalFirst->as<Fn>())(args, env);
+
+        ObPtr evalFirst = EVAL(list->at(0), env);
+        ArgFrame frame;
+        for (auto it = list->begin() + 1; it != list->end(); ++it)
+            argStack.push_back(EVAL(*it, env));
+        Args args = frame.args();
+        if (evalFirst.is<Fn>()) {
+            return (*evalFirst->as<Fn>())(args, *env);
+        } else if (evalFirst.is<Closure>()) {
+            Closure* closure = evalFirst->as<Closure>();
+            if (closure->names()) {
+                if (int(args.size()) != closure->params()->as<Sequence>()->size())
+                    throw TypeError(closure->params()->repr() + " and " +
+                        newList(args)->repr() + " must be the same size");
+                EnvPtr callEnv = std::make_shared<Env>(closure->env(),
+                                                       closure->names());
+                std::move(argStack.begin() + frame.base(), argStack.end(),
+                          callEnv->slots_.begin());
+                env = callEnv;
+                ast = closure->body();
+                continue;
+            }
+            env = EnvPtr(new Env(closure->env(), closure->params(),
+                                 newList(args)));
+            ast = closure->body();
+            continue;
         } else
             throw NotFound("<function> " + evalFirst->repr() + "()");
     }
 }
 
-ObPtr evalAst(ObPtr ast, Env& env) {
-    if (ast->is<Symbol>()) {
-        ObPtr sym = env.get(ast);
+ObPtr evalAst(ObPtr ast, EnvPtr env) {
+    if (ast.is<LocalRef>()) {
+        const LocalRef* ref = ast->as<LocalRef>();
+        return env->local(ref->depth(), ref->slot(), ref->symbol());
+    } else if (ast.is<GlobalSym>()) {
+        return ast->as<GlobalSym>()->lookup(*env);
+    } else if (ast.is<Symbol>()) {
+        ObPtr sym = env->get(ast);
         return sym;
-    } else if (ast->is<List>()) {
+    } else if (ast.is<List>()) {
         ObPtr result = newList();
         for (auto& e : *(ast->as<List>())) {
             result->as<List>()->push(EVAL(e, env));
         }
         return result;
-    } else if (ast->is<Vector>()) {
-        ObPtr result = newVector();
-        for (auto& e : *(ast->as<Vector>()))
-            result->as<Vector>()->push(EVAL(e, env));
-        return result;
-    } else if (ast->is<HashMap>()) {
-        ObPtr result = newHashMap();
-        for (auto& e : *(ast->as<HashMap>()))
-            result->as<HashMap>()->set(e.first, EVAL(e.second, env));
-        return result;
+    } else if (ast.is<Vector>()) {
+        // Most vectors hold data rather than code, so the vector itself is
+        // returned until an element evaluates to something else
+        const PersistentVector& items = ast->as<Vector>()->items();
+        std::size_t i = 0;
+        for (auto it = ast->as<Sequence>()->begin(); i < items.size(); ++it, ++i) {
+            ObPtr value = EVAL(*it, env);
+            if (value == *it)
+                continue;
+            PersistentVector::Builder result(items);
+            result.set(i, std::move(value));
+            for (++it, ++i; i < items.size(); ++it, ++i)
+                result.set(i, EVAL(*it, env));
+            return newVector(result.persistent());
+        }
+        return ast;
+    } else if (ast.is<HashMap>()) {
+        // As with vectors, the map itself until a value changes
+        const PersistentMap& items = ast->as<HashMap>()->items();
+        for (auto it = items.begin(); it != items.end(); ++it) {
+            ObPtr value = EVAL(it->value, env);
+            if (value == it->value)
+                continue;
+            PersistentMap::Builder result(items);
+            result.set(it->key, std::move(value));
+            for (++it; it != items.end(); ++it)
+                result.set(it->key, EVAL(it->value, env));
+            return newHashMap(result.persistent());
+        }
+        return ast;
     } else
         return ast;
 }
@@ -118,10 +209,12 @@ std::string PRINT(ObPtr input) {
     return prStr(input);
 }
 
-std::string rep(std::string input, Env& env) {
+// Runs eval() and reports interpreter errors, returning nullptr for them
+template<typename F>
+static ObPtr evalReportingErrors(F eval) {
     ObPtr result = nullptr;
     try {
-        result = EVAL(READ(input), env);
+        result = eval();
     } catch (const NotFound& e) {
         std::cerr << "[Not Found]: " << e.what();
     } catch (const SyntaxError& e) {
@@ -137,6 +230,48 @@ std::string rep(std::string input, Env& env) {
     } catch (const std::bad_cast& e) {
         std::cerr << "[BADCAST :(]: " << e.what();
     }
-    return PRINT(result);
+    return result;
+}
+
+std::string rep(std::string input, EnvPtr env) {
+    return PRINT(evalReportingErrors([&] {
+        return EVAL(resolve(READ(input)), env);
+    }));
+}
+
+std::string rep(std::string input, VM& vm) {
+    return PRINT(evalReportingErrors([&] { return vm.run(READ(input)); }));
 }
 
+// Evaluates each form of the stream as soon as it is read. Errors are
+// reported and evaluation goes on; returns false if there were any.
+template<typename F>
+static bool runForms(std::istream& in, F eval) {
+    FormStream forms(in);
+    bool ok = true;
+    for (;;) {
+        bool done = false;
+        ObPtr result = evalReportingErrors([&] {
+            ObPtr ast = forms.next();
+            if (!ast) {
+                done = true;
+                return newNil();
+            }
+            return eval(ast);
+        });
+        if (done)
+            return ok;
+        if (!result) {
+            std::cerr << std::endl;
+            ok = false;
+        }
+    }
+}
+
+bool runScript(std::istream& in, EnvPtr env) {
+    return runForms(in, [&](ObPtr ast) { return EVAL(resolve(ast), env); });
+}
+
+bool runScript(std::istream& in, VM& vm) {
+    return runForms(in, [&](ObPtr ast) { return vm.run(ast); });
+}
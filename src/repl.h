@@ -1,6 +1,7 @@
 #ifndef _REPL_H_
 #define _REPL_H_
 
+#include <istream>
 #include <string>
 
 #include "environment.h"
@@ -9,6 +10,8 @@
 #include "reader.h"
 #include "types.h"
 
+class VM;
+
 const std::string RESET   = "\033[0m";
 const std::string BLACK   = "\033[30m";
 const std::string RED     = "\033[31m";
@@ -19,12 +22,22 @@ const std::string MAGENTA = "\033[35m";
 const std::string CYAN    = "\033[36m";
 const std::string WHITE   = "\033[37m";
 
+// Special form symbols, shared with the compiler
+extern const ObPtr DEF_SYM;
+extern const ObPtr LET_SYM;
+extern const ObPtr DO_SYM;
+extern const ObPtr IF_SYM;
+extern const ObPtr FN_SYM;
+
 
 ObPtr READ(std::string input);
-ObPtr EVAL(ObPtr ast, Env& env);
+ObPtr EVAL(ObPtr ast, EnvPtr env);
 std::string PRINT(ObPtr input);
-ObPtr evalAst(ObPtr ast, Env& env);
-std::string rep(std::string input, Env& env);
+ObPtr evalAst(ObPtr ast, EnvPtr env);
+std::string rep(std::string input, EnvPtr env);
+std::string rep(std::string input, VM& vm);
+bool runScript(std::istream& in, EnvPtr env);
+bool runScript(std::istream& in, VM& vm);
 
 
 #endif
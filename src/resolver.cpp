@@ -0,0 +1,165 @@
+#include <vector>
+
+#include "repl.h"
+#include "resolver.h"
+
+
+static bool isSpecialForm(const ObPtr& sym) {
+    return sym == DEF_SYM || sym == LET_SYM || sym == DO_SYM ||
+           sym == IF_SYM || sym == FN_SYM;
+}
+
+static bool allSymbols(const Sequence& names) {
+    for (auto& e : names)
+        if (!e.is<Symbol>())
+            return false;
+    return true;
+}
+
+static int slotIn(const Scope& scope, const ObPtr& sym) {
+    for (int i = scope.size() - 1; i >= 0; i--)
+        if (scope[i] == sym)
+            return i;
+    return -1;
+}
+
+static int addName(Scope& scope, const ObPtr& sym) {
+    int slot = slotIn(scope, sym);
+    if (slot >= 0)
+        return slot;
+    scope.push_back(sym);
+    return scope.size() - 1;
+}
+
+void collectDefs(const ObPtr& ast, Scope& scope) {
+    if (ast.is<List>()) {
+        const List* list = ast->as<List>();
+        if (list->empty())
+            return;
+        ObPtr first = list->at(0);
+        if (first == LET_SYM || first == FN_SYM)
+            return;
+        if (first == DEF_SYM && list->size() >= 3 && list->at(1).is<Symbol>())
+            addName(scope, list->at(1));
+        for (auto& e : *list)
+            collectDefs(e, scope);
+    } else if (ast.is<Vector>()) {
+        for (auto& e : *ast->as<Vector>())
+            collectDefs(e, scope);
+    } else if (ast.is<HashMap>()) {
+        for (auto& entry : *ast->as<HashMap>())
+            collectDefs(entry.value, scope);
+    }
+}
+
+static ObPtr resolveIn(const ObPtr& ast, std::vector<Scope>& scopes);
+
+static ObPtr resolveSymbol(const ObPtr& sym, const std::vector<Scope>& scopes) {
+    for (int depth = 0; depth < int(scopes.size()); depth++) {
+        const Scope& scope = scopes[scopes.size() - 1 - depth];
+        int slot = slotIn(scope, sym);
+        if (slot >= 0)
+            return ObPtr(new LocalRef(sym, depth, slot));
+    }
+    return ObPtr(new GlobalSym(sym));
+}
+
+static ObPtr newNames(const Scope& scope) {
+    return newVector(scope.cbegin(), scope.cend());
+}
+
+static ObPtr resolveLet(const ObPtr& ast, std::vector<Scope>& scopes) {
+    const List* list = ast->as<List>();
+    if (list->size() != 3 || !list->at(1).is<Sequence>())
+        return ast;
+    const Sequence* binds = list->at(1)->as<Sequence>();
+    if (binds->size() % 2 != 0)
+        return ast;
+
+    Scope scope;
+    std::vector<int> slots;
+    for (int i = 0; i < binds->size(); i += 2) {
+        if (!binds->at(i).is<Symbol>())
+            return ast;
+        slots.push_back(addName(scope, binds->at(i)));
+    }
+    for (int i = 1; i < binds->size(); i += 2)
+        collectDefs(binds->at(i), scope);
+    collectDefs(list->at(2), scope);
+
+    scopes.push_back(std::move(scope));
+    std::vector<ObPtr> inits;
+    for (int i = 1; i < binds->size(); i += 2)
+        inits.push_back(resolveIn(binds->at(i), scopes));
+    ObPtr body = resolveIn(list->at(2), scopes);
+    ObPtr names = newNames(scopes.back());
+    scopes.pop_back();
+    return ObPtr(new LetForm(ast, names, std::move(slots), std::move(inits),
+                             body));
+}
+
+static ObPtr resolveFn(const ObPtr& ast, std::vector<Scope>& scopes) {
+    const List* list = ast->as<List>();
+    if (list->size() < 3 || !list->at(1).is<Sequence>())
+        return ast;
+    ObPtr params = list->at(1);
+    if (!allSymbols(*params->as<Sequence>()))
+        return ast;
+
+    // Parameters keep their positions, so arguments fill slots in order
+    Scope scope(params->as<Sequence>()->begin(), params->as<Sequence>()->end());
+    collectDefs(list->at(2), scope);
+
+    scopes.push_back(std::move(scope));
+    ObPtr body = resolveIn(list->at(2), scopes);
+    ObPtr names = newNames(scopes.back());
+    scopes.pop_back();
+    return ObPtr(new FnForm(ast, params, names, body));
+}
+
+static ObPtr resolveIn(const ObPtr& ast, std::vector<Scope>& scopes) {
+    if (ast.is<Symbol>())
+        return resolveSymbol(ast, scopes);
+    if (ast.is<List>()) {
+        const List* list = ast->as<List>();
+        if (list->empty())
+            return ast;
+        ObPtr first = list->at(0);
+        if (first == LET_SYM)
+            return resolveLet(ast, scopes);
+        if (first == FN_SYM)
+            return resolveFn(ast, scopes);
+
+        std::vector<ObPtr> items;
+        items.reserve(list->size());
+        items.push_back(isSpecialForm(first) ? first : resolveIn(first, scopes));
+        for (int i = 1; i < list->size(); i++) {
+            // def! targets are slots of the innermost frame, or globals
+            if (first == DEF_SYM && i == 1 && list->at(1).is<Symbol>()) {
+                int slot = scopes.empty() ? -1 : slotIn(scopes.back(), list->at(1));
+                items.push_back(slot < 0 ? list->at(1)
+                                         : ObPtr(new LocalRef(list->at(1), 0, slot)));
+            } else
+                items.push_back(resolveIn(list->at(i), scopes));
+        }
+        return newList(items.cbegin(), items.cend());
+    }
+    if (ast.is<Vector>()) {
+        std::vector<ObPtr> items;
+        for (auto& e : *ast->as<Vector>())
+            items.push_back(resolveIn(e, scopes));
+        return newVector(items.cbegin(), items.cend());
+    }
+    if (ast.is<HashMap>()) {
+        ObPtr map = newHashMap();
+        for (auto& entry : *ast->as<HashMap>())
+            map->as<HashMap>()->set(entry.key, resolveIn(entry.value, scopes));
+        return map;
+    }
+    return ast;
+}
+
+ObPtr resolve(const ObPtr& ast) {
+    std::vector<Scope> scopes;
+    return resolveIn(ast, scopes);
+}
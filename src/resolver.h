@@ -0,0 +1,26 @@
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+
+#include <vector>
+
+#include "types.h"
+
+
+// Names of a frame's slots, in slot order
+typedef std::vector<ObPtr> Scope;
+
+
+// Rewrites a top-level form for the tree-walker: symbols become LocalRef
+// or GlobalSym, and let* and fn* forms whose names are all symbols
+// become LetForm and FnForm. A def! inside a let* or fn* binds in that
+// frame, so its name gets a slot there too. Malformed forms are left as
+// they are, and so is everything inside a let* or fn* that is not
+// resolved, for EVAL to handle (or report) as before.
+ObPtr resolve(const ObPtr& ast);
+
+// Adds to scope the names that def! forms in ast bind in ast's frame:
+// everything but the insides of let* and fn*, which get frames of their
+// own. Names already in scope are not added again.
+void collectDefs(const ObPtr& ast, Scope& scope);
+
+#endif
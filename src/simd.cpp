@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+#include "cpu.h"
+#include "simd.h"
+#include "types.h"
+
+
+static SimdLevel supportedLevel() {
+#ifdef SIMD_X86
+    if (cpuFeatures().avx2 && cpuFeatures().fma)
+        return SimdLevel::Avx2;
+    // SSE2 is part of x86-64
+    return SimdLevel::Sse2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+static SimdLevel& currentLevel() {
+    static SimdLevel level = supportedLevel();
+    return level;
+}
+
+SimdLevel simdLevel() {
+    return currentLevel();
+}
+
+void setSimdLevel(SimdLevel level) {
+    currentLevel() = std::min(level, supportedLevel());
+}
+
+
+// Operations at every width: one double, an SSE2 pair and an AVX2 quad
+
+struct AddOp {
+    static double apply(double l, double r) { return l + r; }
+#ifdef SIMD_X86
+    static __m128d apply(__m128d l, __m128d r) { return _mm_add_pd(l, r); }
+    __attribute__((target("avx2,fma")))
+    static __m256d apply(__m256d l, __m256d r) { return _mm256_add_pd(l, r); }
+#endif
+};
+
+struct SubOp {
+    static double apply(double l, double r) { return l - r; }
+#ifdef SIMD_X86
+    static __m128d apply(__m128d l, __m128d r) { return _mm_sub_pd(l, r); }
+    __attribute__((target("avx2,fma")))
+    static __m256d apply(__m256d l, __m256d r) { return _mm256_sub_pd(l, r); }
+#endif
+};
+
+struct MulOp {
+    static double apply(double l, double r) { return l * r; }
+#ifdef SIMD_X86
+    static __m128d apply(__m128d l, __m128d r) { return _mm_mul_pd(l, r); }
+    __attribute__((target("avx2,fma")))
+    static __m256d apply(__m256d l, __m256d r) { return _mm256_mul_pd(l, r); }
+#endif
+};
+
+struct DivOp {
+    static double apply(double l, double r) { return l / r; }
+#ifdef SIMD_X86
+    static __m128d apply(__m128d l, __m128d r) { return _mm_div_pd(l, r); }
+    __attribute__((target("avx2,fma")))
+    static __m256d apply(__m256d l, __m256d r) { return _mm256_div_pd(l, r); }
+#endif
+};
+
+// min and max return NaN if either operand is NaN, at every width: the
+// bare instructions return the second operand instead, and std::min
+// and std::max the first. The NaN is l + r's, which also agrees.
+
+struct MinOp {
+    static double apply(double l, double r) {
+        return std::isnan(l) || std::isnan(r) ? l + r : std::min(l, r);
+    }
+#ifdef SIMD_X86
+    static __m128d apply(__m128d l, __m128d r) {
+        __m128d nan = _mm_cmpunord_pd(l, r);
+        return _mm_or_pd(_mm_and_pd(nan, _mm_add_pd(l, r)),
+                         _mm_andnot_pd(nan, _mm_min_pd(l, r)));
+    }
+    __attribute__((target("avx2,fma")))
+    static __m256d apply(__m256d l, __m256d r) {
+        __m256d nan = _mm256_cmp_pd(l, r, _CMP_UNORD_Q);
+        return _mm256_blendv_pd(_mm256_min_pd(l, r), _mm256_add_pd(l, r), nan);
+    }
+#endif
+};
+
+struct MaxOp {
+    static double apply(double l, double r) {
+        return std::isnan(l) || std::isnan(r) ? l + r : std::max(l, r);
+    }
+#ifdef SIMD_X86
+    static __m128d apply(__m128d l, __m128d r) {
+        __m128d nan = _mm_cmpunord_pd(l, r);
+        return _mm_or_pd(_mm_and_pd(nan, _mm_add_pd(l, r)),
+                         _mm_andnot_pd(nan, _mm_max_pd(l, r)));
+    }
+    __attribute__((target("avx2,fma")))
+    static __m256d apply(__m256d l, __m256d r) {
+        __m256d nan = _mm256_cmp_pd(l, r, _CMP_UNORD_Q);
+        return _mm256_blendv_pd(_mm256_max_pd(l, r), _mm256_add_pd(l, r), nan);
+    }
+#endif
+};
+
+// Right operands of combine: an array, or a scalar in every lane
+
+struct ArrayRhs {
+    const double* r;
+    double at(long j) const { return r[j]; }
+#ifdef SIMD_X86
+    __m128d pair(long j) const { return _mm_loadu_pd(r + j); }
+    __attribute__((target("avx2,fma")))
+    __m256d quad(long j) const { return _mm256_loadu_pd(r + j); }
+#endif
+};
+
+struct ScalarRhs {
+    double r;
+    double at(long) const { return r; }
+#ifdef SIMD_X86
+    __m128d pair(long) const { return _mm_set1_pd(r); }
+    __attribute__((target("avx2,fma")))
+    __m256d quad(long) const { return _mm256_set1_pd(r); }
+#endif
+};
+
+
+// Elementwise kernels
+
+template<typename Op, typename Rhs>
+static void combineScalar(const double* l, Rhs r, double* out, long n) {
+    for (long j = 0; j < n; j++)
+        out[j] = Op::apply(l[j], r.at(j));
+}
+
+#ifdef SIMD_X86
+template<typename Op, typename Rhs>
+static void combineSse2(const double* l, Rhs r, double* out, long n) {
+    long j = 0;
+    for (; j + 2 <= n; j += 2)
+        _mm_storeu_pd(out + j, Op::apply(_mm_loadu_pd(l + j), r.pair(j)));
+    for (; j < n; j++)
+        out[j] = Op::apply(l[j], r.at(j));
+}
+
+template<typename Op, typename Rhs>
+__attribute__((target("avx2,fma")))
+static void combineAvx2(const double* l, Rhs r, double* out, long n) {
+    long j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256d lo = Op::apply(_mm256_loadu_pd(l + j), r.quad(j));
+        __m256d hi = Op::apply(_mm256_loadu_pd(l + j + 4), r.quad(j + 4));
+        _mm256_storeu_pd(out + j, lo);
+        _mm256_storeu_pd(out + j + 4, hi);
+    }
+    for (; j < n; j++)
+        out[j] = Op::apply(l[j], r.at(j));
+}
+#endif
+
+template<typename Op, typename Rhs>
+static void combineWith(const double* l, Rhs r, double* out, long n) {
+    switch (simdLevel()) {
+#ifdef SIMD_X86
+        case SimdLevel::Avx2: return combineAvx2<Op>(l, r, out, n);
+        case SimdLevel::Sse2: return combineSse2<Op>(l, r, out, n);
+#endif
+        default:              return combineScalar<Op>(l, r, out, n);
+    }
+}
+
+template<typename Rhs>
+static void combine(ArithOp op, const double* l, Rhs r, double* out, long n) {
+    switch (op) {
+        case ArithOp::Add:      return combineWith<AddOp>(l, r, out, n);
+        case ArithOp::Subtract: return combineWith<SubOp>(l, r, out, n);
+        case ArithOp::Multiply: return combineWith<MulOp>(l, r, out, n);
+        case ArithOp::Divide:   return combineWith<DivOp>(l, r, out, n);
+    }
+}
+
+void simdCombine(ArithOp op, const double* l, const double* r,
+                 double* out, long n) {
+    combine(op, l, ArrayRhs { r }, out, n);
+}
+
+void simdCombine(ArithOp op, const double* l, double r, double* out, long n) {
+    combine(op, l, ScalarRhs { r }, out, n);
+}
+
+
+// Reductions. The vector forms keep several independent accumulators so
+// consecutive adds do not wait on each other, then fold the lanes.
+
+template<typename Op>
+static double reduceScalar(const double* x, long n, double init) {
+    double res = init;
+    for (long j = 0; j < n; j++)
+        res = Op::apply(res, x[j]);
+    return res;
+}
+
+static double dotScalar(const double* x, const double* y, long n) {
+    double res = 0;
+    for (long j = 0; j < n; j++)
+        res += x[j] * y[j];
+    return res;
+}
+
+#ifdef SIMD_X86
+template<typename Op>
+static double reduceSse2(const double* x, long n, double init) {
+    __m128d a0 = _mm_set1_pd(init), a1 = a0;
+    long j = 0;
+    for (; j + 4 <= n; j += 4) {
+        a0 = Op::apply(a0, _mm_loadu_pd(x + j));
+        a1 = Op::apply(a1, _mm_loadu_pd(x + j + 2));
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, Op::apply(a0, a1));
+    return reduceScalar<Op>(x + j, n - j, Op::apply(lanes[0], lanes[1]));
+}
+
+static double dotSse2(const double* x, const double* y, long n) {
+    __m128d a0 = _mm_setzero_pd(), a1 = a0;
+    long j = 0;
+    for (; j + 4 <= n; j += 4) {
+        a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_loadu_pd(x + j), _mm_loadu_pd(y + j)));
+        a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_loadu_pd(x + j + 2),
+                                       _mm_loadu_pd(y + j + 2)));
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, _mm_add_pd(a0, a1));
+    return lanes[0] + lanes[1] + dotScalar(x + j, y + j, n - j);
+}
+
+template<typename Op>
+__attribute__((target("avx2,fma")))
+static double reduceAvx2(const double* x, long n, double init) {
+    __m256d a0 = _mm256_set1_pd(init), a1 = a0, a2 = a0, a3 = a0;
+    long j = 0;
+    for (; j + 16 <= n; j += 16) {
+        a0 = Op::apply(a0, _mm256_loadu_pd(x + j));
+        a1 = Op::apply(a1, _mm256_loadu_pd(x + j + 4));
+        a2 = Op::apply(a2, _mm256_loadu_pd(x + j + 8));
+        a3 = Op::apply(a3, _mm256_loadu_pd(x + j + 12));
+    }
+    for (; j + 4 <= n; j += 4)
+        a0 = Op::apply(a0, _mm256_loadu_pd(x + j));
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, Op::apply(Op::apply(a0, a1), Op::apply(a2, a3)));
+    double res = Op::apply(Op::apply(lanes[0], lanes[1]),
+                           Op::apply(lanes[2], lanes[3]));
+    return reduceScalar<Op>(x + j, n - j, res);
+}
+
+__attribute__((target("avx2,fma")))
+static double dotAvx2(const double* x, const double* y, long n) {
+    __m256d a0 = _mm256_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+    long j = 0;
+    for (; j + 16 <= n; j += 16) {
+        a0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + j), _mm256_loadu_pd(y + j), a0);
+        a1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + j + 4),
+                             _mm256_loadu_pd(y + j + 4), a1);
+        a2 = _mm256_fmadd_pd(_mm256_loadu_pd(x + j + 8),
+                             _mm256_loadu_pd(y + j + 8), a2);
+        a3 = _mm256_fmadd_pd(_mm256_loadu_pd(x + j + 12),
+                             _mm256_loadu_pd(y + j + 12), a3);
+    }
+    for (; j + 4 <= n; j += 4)
+        a0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + j), _mm256_loadu_pd(y + j), a0);
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_add_pd(_mm256_add_pd(a0, a1),
+                                         _mm256_add_pd(a2, a3)));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           dotScalar(x + j, y + j, n - j);
+}
+#endif
+
+template<typename Op>
+static double reduce(const double* x, long n, double init) {
+    switch (simdLevel()) {
+#ifdef SIMD_X86
+        case SimdLevel::Avx2: return reduceAvx2<Op>(x, n, init);
+        case SimdLevel::Sse2: return reduceSse2<Op>(x, n, init);
+#endif
+        default:              return reduceScalar<Op>(x, n, init);
+    }
+}
+
+double simdSum(const double* x, long n) {
+    return reduce<AddOp>(x, n, 0.0);
+}
+
+double simdDot(const double* x, const double* y, long n) {
+    switch (simdLevel()) {
+#ifdef SIMD_X86
+        case SimdLevel::Avx2: return dotAvx2(x, y, n);
+        case SimdLevel::Sse2: return dotSse2(x, y, n);
+#endif
+        default:              return dotScalar(x, y, n);
+    }
+}
+
+double simdMin(const double* x, long n) {
+    return reduce<MinOp>(x, n, x[0]);
+}
+
+double simdMax(const double* x, long n) {
+    return reduce<MaxOp>(x, n, x[0]);
+}
+
+long simdArgmax(const double* x, long n) {
+    double max = simdMax(x, n);
+    bool nan = std::isnan(max);
+    for (long j = 0; j < n; j++)
+        if (nan ? std::isnan(x[j]) : !(x[j] < max))
+            return j;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+enum class ArithOp;
+
+
+// Instruction set the vector kernels below run with. It is picked once
+// from cpuFeatures(), and can be lowered to compare the paths.
+enum class SimdLevel { Scalar, Sse2, Avx2 };
+
+SimdLevel simdLevel();
+// Clamped to what the CPU supports
+void setSimdLevel(SimdLevel level);
+
+// out[j] = l[j] op r[j], or l[j] op r for a scalar r; out may alias l
+void simdCombine(ArithOp op, const double* l, const double* r,
+                 double* out, long n);
+void simdCombine(ArithOp op, const double* l, double r, double* out, long n);
+
+// Reductions over n doubles; min, max and argmax need n > 0. min and
+// max are NaN if any element is, and argmax returns the first index of
+// the maximum, or of the first NaN.
+double simdSum(const double* x, long n);
+double simdDot(const double* x, const double* y, long n);
+double simdMin(const double* x, long n);
+double simdMax(const double* x, long n);
+long simdArgmax(const double* x, long n);
+
+#endif
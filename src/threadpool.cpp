@@ -0,0 +1,154 @@
+#include <cstdlib>
+
+#include "threadpool.h"
+
+
+// Set while a thread runs a task, nested parallelFor calls go serial
+static thread_local bool insideTask = false;
+
+// Tasks per thread a batch is split into, so stealing can even out
+// uneven progress
+const static long TASKS_PER_THREAD = 4;
+
+
+ThreadPool::ThreadPool(unsigned threads) : queued_(0), stopping_(false) {
+    start(threads);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::resize(unsigned threads) {
+    stop();
+    start(threads);
+}
+
+void ThreadPool::start(unsigned threads) {
+    threads = std::max(1u, threads);
+    stopping_ = false;
+    for (unsigned i = 0; i < threads; i++)
+        queues_.emplace_back(new Queue);
+    for (unsigned i = 1; i < threads; i++)
+        workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_)
+        worker.join();
+    workers_.clear();
+    queues_.clear();
+}
+
+bool ThreadPool::tryPop(unsigned self, Task& task) {
+    {
+        Queue& own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            queued_--;
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < size(); i++) {
+        Queue& victim = *queues_[(self + i) % size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(const Task& task) {
+    insideTask = true;
+    try {
+        (*task.body)(task.begin, task.end);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(task.batch->mutex);
+        if (!task.batch->error)
+            task.batch->error = std::current_exception();
+    }
+    insideTask = false;
+    Batch& batch = *task.batch;
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    if (--batch.pending == 0)
+        batch.done.notify_one();
+}
+
+void ThreadPool::workerLoop(unsigned self) {
+    Task task;
+    for (;;) {
+        if (tryPop(self, task)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_)
+            return;
+    }
+}
+
+void ThreadPool::parallelFor(long begin, long end, long grain,
+                             const RangeFn& body) {
+    long length = end - begin;
+    if (length <= 0)
+        return;
+    grain = std::max(1L, grain);
+    if (size() == 1 || insideTask || length < 2 * grain) {
+        body(begin, end);
+        return;
+    }
+
+    long tasks = std::min(length / grain, long(size()) * TASKS_PER_THREAD);
+    Batch batch;
+    batch.pending = tasks;
+    for (long t = 0; t < tasks; t++) {
+        Task task = { &body, begin + length * t / tasks,
+                      begin + length * (t + 1) / tasks, &batch };
+        Queue& queue = *queues_[t % size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+        queued_++;
+    }
+    {
+        // Workers check queued_ under this lock, so none misses the wakeup
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+    }
+    wake_.notify_all();
+
+    // Help until nothing is left to take, then sleep until the tasks
+    // still running elsewhere finish
+    Task task;
+    while (tryPop(0, task))
+        run(task);
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.done.wait(lock, [&batch] { return batch.pending == 0; });
+    if (batch.error)
+        std::rethrow_exception(batch.error);
+}
+
+static unsigned defaultThreads() {
+    if (const char* env = std::getenv("MAL_THREADS")) {
+        char* end;
+        long threads = std::strtol(env, &end, 10);
+        if (*env && !*end && threads > 0 && threads <= MAX_THREADS)
+            return threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadPool& threadPool() {
+    static ThreadPool pool(defaultThreads());
+    return pool;
+}
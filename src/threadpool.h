@@ -0,0 +1,91 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Elements a task should cover at least, so dispatch stays well below
+// the cost of the work itself
+const static long PARALLEL_GRAIN = 1 << 14;
+
+// Upper bound accepted for the pool size
+const static unsigned MAX_THREADS = 1024;
+
+// Rows per task for row-wise loops over rows of the given length
+inline long parallelRowGrain(long rowLength) {
+    return std::max(1L, PARALLEL_GRAIN / std::max(1L, rowLength));
+}
+
+
+// Work-stealing pool shared by the whole runtime. Each worker owns a
+// deque: it pops its own tasks from the back and steals from the front
+// of the others when it runs dry. The thread calling parallelFor works
+// on the batch too, so a pool of size n has n - 1 workers.
+class ThreadPool {
+public:
+    typedef std::function<void(long, long)> RangeFn;
+
+private:
+    struct Batch {
+        long pending;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+    struct Task {
+        const RangeFn* body;
+        long begin;
+        long end;
+        Batch* batch;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // queues_[0] belongs to the calling thread, queues_[i] to workers_[i-1]
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::atomic<long> queued_;
+    bool stopping_;
+
+public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return queues_.size(); }
+    // Must not be called while a parallelFor is running
+    void resize(unsigned threads);
+
+    // Calls body on disjoint subranges covering [begin, end), each at
+    // least grain long, and returns once all of them are done. The first
+    // exception thrown by body is rethrown here. Small ranges, pools of
+    // one thread and calls from inside a task run serially.
+    void parallelFor(long begin, long end, long grain, const RangeFn& body);
+
+private:
+    void start(unsigned threads);
+    void stop();
+    bool tryPop(unsigned self, Task& task);
+    void run(const Task& task);
+    void workerLoop(unsigned self);
+};
+
+// Sized from the MAL_THREADS environment variable, or the number of
+// hardware threads if it is unset or invalid
+ThreadPool& threadPool();
+
+#endif
@@ -1,27 +1,93 @@
 #include <algorithm>
+#include <climits>
 #include <iomanip>
 #include <limits>
 #include <math.h>
 #include <sstream>
 #include <vector>
 
+#include "arena.h"
+#include "gemm.h"
+#include "simd.h"
+#include "threadpool.h"
 #include "types.h"
 #include "utils.h"
 
 
-ObPtr newSymbol(std::string val) {
-    return ObPtr(new Symbol(val));
+// Keys view the name stored in the Symbol itself; symbols are never
+// removed, so the views stay valid.
+static std::unordered_map<std::string_view, ObPtr>& symbolTable() {
+    static std::unordered_map<std::string_view, ObPtr> table;
+    return table;
+}
+
+ObPtr newSymbol(std::string_view val) {
+    auto& table = symbolTable();
+    auto it = table.find(val);
+    if (it != table.end())
+        return it->second;
+    ObPtr sym(new Symbol(val, table.size()));
+    table.emplace(sym->as<Symbol>()->name(), sym);
+    return sym;
+}
+
+// The objects immediate True, False, Nil and small Integers stand for
+// when dereferenced. They are never destroyed and never referenced by an
+// ObPtr, so their counts stay untouched.
+static Integer* const* smallIntegers() {
+    static Integer* const* cache = [] {
+        auto* ints = new Integer*[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+        for (long long i = SMALL_INT_MIN; i <= SMALL_INT_MAX; i++)
+            ints[i - SMALL_INT_MIN] = new Integer(i);
+        return ints;
+    }();
+    return cache;
+}
+
+Object* ObPtr::box() const {
+    static Object* const trueObject = new True;
+    static Object* const falseObject = new False;
+    static Object* const nilObject = new Nil;
+    if (isNil())
+        return nilObject;
+    if (isTrue())
+        return trueObject;
+    if (isFalse())
+        return falseObject;
+    Object* boxed;
+    if (isInteger()) {
+        long long val = integerValue();
+        if (val >= SMALL_INT_MIN && val <= SMALL_INT_MAX)
+            return smallIntegers()[val - SMALL_INT_MIN];
+        boxed = new Integer(val);
+    } else
+        boxed = new Float(floatValue());
+    boxed->retain();
+    bits_ = reinterpret_cast<std::uint64_t>(boxed);
+    return boxed;
 }
 
 ObPtr newInteger(long long val) {
+    if (val >= ObPtr::IMMEDIATE_MIN && val <= ObPtr::IMMEDIATE_MAX)
+        return ObPtr::integer(val);
     return ObPtr(new Integer(val));
 }
 
+ObPtr newInteger(const BigInt& val) {
+    if (val.fitsLongLong())
+        return newInteger(val.toLongLong());
+    return ObPtr(new BigInteger(val));
+}
+
 ObPtr newFloat(double val) {
-    return ObPtr(new Float(val));
+    return ObPtr::flt(val);
+}
+
+ObPtr newRational(long long num, long long den) {
+    return ObPtr(new Rational(num, den));
 }
 
-ObPtr newRational(int num, int den) {
+ObPtr newRational(const BigInt& num, const BigInt& den) {
     return ObPtr(new Rational(num, den));
 }
 
@@ -33,6 +99,13 @@ ObPtr newList(SequenceConstIter begin, SequenceConstIter end) {
     return ObPtr(new List(begin, end));
 }
 
+ObPtr newList(Args items) {
+    ObPtr list = newList();
+    for (auto& e : items)
+        list->as<List>()->push(e);
+    return list;
+}
+
 ObPtr newVector() {
     return ObPtr(new Vector);
 }
@@ -41,38 +114,65 @@ ObPtr newVector(SequenceConstIter begin, SequenceConstIter end) {
     return ObPtr(new Vector(begin, end));
 }
 
+ObPtr newVector(PersistentVector items) {
+    return ObPtr(new Vector(std::move(items)));
+}
+
 ObPtr newFn(Function ptr) {
     return ObPtr(new Fn(ptr));
 }
 
+ObPtr newClosure(ObPtr params, ObPtr body, EnvPtr env, ObPtr names) {
+    return ObPtr(new Closure(params, body, env, names));
+}
+
 ObPtr newBool(bool expr) {
     return expr ? newTrue() : newFalse();
 }
 
 ObPtr newTrue() {
-    return ObPtr(new True);
+    return ObPtr::boolean(true);
 }
 
 ObPtr newFalse() {
-    return ObPtr(new False);
+    return ObPtr::boolean(false);
 }
 
 ObPtr newNil() {
-    return ObPtr(new Nil);
+    return ObPtr::nil();
 }
 
 ObPtr newHashMap() {
     return ObPtr(new HashMap);
 }
 
+ObPtr newHashMap(PersistentMap items) {
+    return ObPtr(new HashMap(std::move(items)));
+}
+
 ObPtr newNvector() {
     return ObPtr(new Nvector);
 }
 
+ObPtr newNvector(int size) {
+    return ObPtr(new Nvector(size));
+}
+
 ObPtr newMatrix() {
     return ObPtr(new Matrix);
 }
 
+ObPtr newMatrix(int m, int n) {
+    return ObPtr(new Matrix(m, n));
+}
+
+
+void Object::destroy() const {
+    if (inArena_)
+        arenaDestroy(this);
+    else
+        delete this;
+}
 
 ObPtr Object::operator==(const Object& rhs) const {
     throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
@@ -127,17 +227,402 @@ std::string Symbol::repr() const {
 }
 
 ObPtr Symbol::operator==(const Object& rhs) const {
-    const Symbol* right = rhs.as<Symbol>();
-    if (right)
-        return newBool(name_ == right->name_);
-    else
-        return newFalse();
+    return newBool(this == &rhs);
 }
 
 // Numeric
 
 Numeric::~Numeric() { };
 
+// Integer, Float, Rational and BigInteger arithmetic goes through a
+// table of kernels indexed by the operator and the types of both
+// operands. Kernels see their operands as a Number, read once from an
+// immediate or an object, and return null for a zero divisor so that the
+// caller can report it with the operands. Integer and Rational kernels
+// check for overflow and redo the operation on BigInts instead of
+// wrapping around.
+
+namespace {
+// Integer value or Rational numerator in num, Rational denominator in
+// den (1 for an Integer), Float value in flt. A BigInteger, and a
+// Rational with BigInt parts, are left in obj, the latter with den 0.
+// Small enough to be passed in registers.
+struct Number {
+    union {
+        long long num;
+        double flt;
+        const Object* obj;
+    };
+    long long den;
+};
+
+typedef ObPtr (*NumericKernel)(Number lhs, Number rhs);
+}
+
+static Number integerNumber(long long val) {
+    Number x;
+    x.num = val;
+    x.den = 1;
+    return x;
+}
+
+static Number floatNumber(double val) {
+    Number x;
+    x.flt = val;
+    x.den = 1;
+    return x;
+}
+
+static Number numberOf(const Object& value) {
+    Number x;
+    switch (value.tag()) {
+        case TypeTag::Integer:
+            return integerNumber(value.as<Integer>()->value());
+        case TypeTag::Float:
+            return floatNumber(value.as<Float>()->value());
+        case TypeTag::BigInteger:
+            x.obj = &value;
+            x.den = 1;
+            return x;
+        default: {
+            const Rational* r = value.as<Rational>();
+            if (r->isBig()) {
+                x.obj = r;
+                x.den = 0;
+            } else {
+                x.num = r->numer();
+                x.den = r->denom();
+            }
+            return x;
+        }
+    }
+}
+
+template<TypeTag T>
+static double toDouble(Number x) {
+    switch (T) {
+        case TypeTag::Integer:
+            return double(x.num);
+        case TypeTag::Float:
+            return x.flt;
+        case TypeTag::BigInteger:
+            return static_cast<const BigInteger*>(x.obj)->asFlt();
+        default:
+            if (x.den == 0)
+                return static_cast<const Rational*>(x.obj)->value();
+            return double(x.num) / x.den;
+    }
+}
+
+// Floats within EPSILON of zero, of either sign, count as zero. A big
+// Rational is never zero: it only goes big when it does not fit.
+template<TypeTag T>
+static bool isZeroDivisor(Number x) {
+    if (T == TypeTag::Integer)
+        return x.num == 0;
+    if (T == TypeTag::BigInteger)
+        return false;
+    if (T == TypeTag::Rational)
+        return x.den != 0 && x.num == 0;
+    return fabs(x.flt) < EPSILON;
+}
+
+// An Integer, a BigInteger or a Rational as num / den
+template<TypeTag T>
+static void fractionOf(Number x, BigInt& num, BigInt& den) {
+    if (T == TypeTag::BigInteger) {
+        num = static_cast<const BigInteger*>(x.obj)->value();
+        den = BigInt(1);
+    } else if (x.den == 0) {
+        const Rational* r = static_cast<const Rational*>(x.obj);
+        num = r->bigNumer();
+        den = r->bigDenom();
+    } else {
+        num = BigInt(x.num);
+        den = BigInt(x.den);
+    }
+}
+
+template<ArithOp op>
+static double applyDouble(double l, double r) {
+    switch (op) {
+        case ArithOp::Add:      return l + r;
+        case ArithOp::Subtract: return l - r;
+        case ArithOp::Multiply: return l * r;
+        case ArithOp::Divide:   return l / r;
+    }
+    return 0;
+}
+
+// Either operand is a Float: the operation on doubles
+template<ArithOp op, TypeTag L, TypeTag R>
+static ObPtr floatKernel(Number lhs, Number rhs) {
+    if (op == ArithOp::Divide && isZeroDivisor<R>(rhs))
+        return nullptr;
+    return newFloat(applyDouble<op>(toDouble<L>(lhs), toDouble<R>(rhs)));
+}
+
+// Integers and BigIntegers, or Integers that overflow. Division gives a
+// Float, as it does for Integers.
+template<ArithOp op, TypeTag L, TypeTag R>
+__attribute__((noinline))
+static ObPtr bigKernel(Number lhs, Number rhs) {
+    BigInt l, r, unit;
+    fractionOf<L>(lhs, l, unit);
+    fractionOf<R>(rhs, r, unit);
+    switch (op) {
+        case ArithOp::Add:      return newInteger(l + r);
+        case ArithOp::Subtract: return newInteger(l - r);
+        case ArithOp::Multiply: return newInteger(l * r);
+        case ArithOp::Divide:
+            if (isZeroDivisor<R>(rhs))
+                return nullptr;
+            return newFloat(BigInt::ratio(l, r));
+    }
+    return nullptr;
+}
+
+// Integer / Integer is a Float, as it has always been
+template<ArithOp op>
+static ObPtr integerKernel(Number lhs, Number rhs) {
+    long long res;
+    bool overflow = false;
+    switch (op) {
+        case ArithOp::Add:
+            overflow = __builtin_add_overflow(lhs.num, rhs.num, &res);
+            break;
+        case ArithOp::Subtract:
+            overflow = __builtin_sub_overflow(lhs.num, rhs.num, &res);
+            break;
+        case ArithOp::Multiply:
+            overflow = __builtin_mul_overflow(lhs.num, rhs.num, &res);
+            break;
+        case ArithOp::Divide:
+            return floatKernel<op, TypeTag::Integer, TypeTag::Integer>(lhs, rhs);
+    }
+    if (overflow)
+        return bigKernel<op, TypeTag::Integer, TypeTag::Integer>(lhs, rhs);
+    return newInteger(res);
+}
+
+// a / g, without dividing for the common g = 1
+static BigInt divideOut(const BigInt& a, const BigInt& g) {
+    static const BigInt one(1);
+    return g == one ? a : a / g;
+}
+
+static ObPtr reducedRational(const BigInt& num, const BigInt& den) {
+    return ObPtr(new Rational(num, den, Rational::Reduced()));
+}
+
+// rationalKernel() for operands or results that do not fit in long long,
+// reducing the same way
+template<ArithOp op, TypeTag L, TypeTag R>
+__attribute__((noinline))
+static ObPtr bigRationalKernel(Number lhs, Number rhs) {
+    BigInt ln, ld, rn, rd;
+    fractionOf<L>(lhs, ln, ld);
+    fractionOf<R>(rhs, rn, rd);
+    switch (op) {
+        case ArithOp::Add:
+        case ArithOp::Subtract: {
+            BigInt g = BigInt::gcd(ld, rd);
+            BigInt l = ln * divideOut(rd, g);
+            BigInt r = rn * divideOut(ld, g);
+            BigInt t = op == ArithOp::Add ? l + r : l - r;
+            BigInt g2 = BigInt::gcd(t, g);
+            return reducedRational(divideOut(t, g2),
+                                   divideOut(ld, g) * divideOut(rd, g2));
+        }
+        case ArithOp::Multiply: {
+            BigInt g1 = BigInt::gcd(ln, rd);
+            BigInt g2 = BigInt::gcd(rn, ld);
+            return reducedRational(divideOut(ln, g1) * divideOut(rn, g2),
+                                   divideOut(ld, g2) * divideOut(rd, g1));
+        }
+        case ArithOp::Divide: {
+            BigInt g1 = BigInt::gcd(ln, rn);
+            BigInt g2 = BigInt::gcd(ld, rd);
+            BigInt num = divideOut(ln, g1) * divideOut(rd, g2);
+            BigInt den = divideOut(ld, g2) * divideOut(rn, g1);
+            if (den.isNegative())
+                return reducedRational(-num, -den);
+            return reducedRational(num, den);
+        }
+    }
+    return nullptr;
+}
+
+static long long divideOut(long long a, long long g) {
+    return g == 1 ? a : a / g;
+}
+
+static unsigned long long magnitude(long long x) {
+    return x < 0 ? 0 - (unsigned long long)x : x;
+}
+
+// gcd(x, den) for den the denominator of an operand of type T, known to
+// be 1 without computing it when that operand is an Integer
+template<TypeTag T>
+static long long gcdWithDenominator(unsigned long long x, long long den) {
+    return T == TypeTag::Integer ? 1 : gcd(x, den);
+}
+
+// num / den as a Rational if both fit in long long. num and den are in
+// lowest terms and den is positive.
+static ObPtr smallRational(__int128 num, __int128 den) {
+    if (num < LLONG_MIN || num > LLONG_MAX || den > LLONG_MAX)
+        return nullptr;
+    return ObPtr(new Rational((long long)num, (long long)den,
+                              Rational::Reduced()));
+}
+
+// A Rational and an Integer, a BigInteger or another Rational: fractions
+// num / den, which are always in lowest terms. Common factors are divided
+// out before multiplying rather than after, so the result needs no
+// reduction and the products stay small; with the products taken in
+// __int128 only a result outside long long needs the BigInt kernel.
+template<ArithOp op, TypeTag L, TypeTag R>
+static ObPtr rationalKernel(Number lhs, Number rhs) {
+    if (op == ArithOp::Divide && isZeroDivisor<R>(rhs))
+        return nullptr;
+    if (L == TypeTag::BigInteger || R == TypeTag::BigInteger ||
+            lhs.den == 0 || rhs.den == 0)
+        return bigRationalKernel<op, L, R>(lhs, rhs);
+    ObPtr res;
+    switch (op) {
+        case ArithOp::Add:
+        case ArithOp::Subtract: {
+            // With g = gcd(d1, d2), n1/d1 + n2/d2 is t / (d1/g * d2) for
+            // t = n1 d2/g + n2 d1/g, and only g can share a factor with t
+            long long g = R == TypeTag::Integer ? 1 : gcdWithDenominator<L>(rhs.den, lhs.den);
+            __int128 l = __int128(lhs.num) * divideOut(rhs.den, g);
+            __int128 r = __int128(rhs.num) * divideOut(lhs.den, g);
+            __int128 t = op == ArithOp::Add ? l + r : l - r;
+            long long g2 = g == 1 ? 1 : gcd(magnitude((long long)(t % g)), g);
+            res = smallRational(g2 == 1 ? t : t / g2,
+                                __int128(divideOut(lhs.den, g)) * divideOut(rhs.den, g2));
+            break;
+        }
+        case ArithOp::Multiply: {
+            long long g1 = gcdWithDenominator<R>(magnitude(lhs.num), rhs.den);
+            long long g2 = gcdWithDenominator<L>(magnitude(rhs.num), lhs.den);
+            res = smallRational(__int128(divideOut(lhs.num, g1)) * divideOut(rhs.num, g2),
+                                __int128(divideOut(lhs.den, g2)) * divideOut(rhs.den, g1));
+            break;
+        }
+        case ArithOp::Divide: {
+            // n1/d1 times d2/n2, with the sign of n2 moved up
+            long long g1 = gcd(magnitude(lhs.num), magnitude(rhs.num));
+            long long g2 = R == TypeTag::Integer ? 1 : gcdWithDenominator<L>(rhs.den, lhs.den);
+            __int128 num = __int128(divideOut(lhs.num, g1)) * divideOut(rhs.den, g2);
+            __int128 den = __int128(divideOut(lhs.den, g2)) * divideOut(rhs.num, g1);
+            res = den < 0 ? smallRational(-num, -den) : smallRational(num, den);
+            break;
+        }
+    }
+    if (!res)
+        return bigRationalKernel<op, L, R>(lhs, rhs);
+    return res;
+}
+
+template<ArithOp op>
+struct NumericKernels {
+    static constexpr NumericKernel table[4][4] = {
+        { integerKernel<op>,
+          floatKernel<op, TypeTag::Integer, TypeTag::Float>,
+          rationalKernel<op, TypeTag::Integer, TypeTag::Rational>,
+          bigKernel<op, TypeTag::Integer, TypeTag::BigInteger> },
+        { floatKernel<op, TypeTag::Float, TypeTag::Integer>,
+          floatKernel<op, TypeTag::Float, TypeTag::Float>,
+          floatKernel<op, TypeTag::Float, TypeTag::Rational>,
+          floatKernel<op, TypeTag::Float, TypeTag::BigInteger> },
+        { rationalKernel<op, TypeTag::Rational, TypeTag::Integer>,
+          floatKernel<op, TypeTag::Rational, TypeTag::Float>,
+          rationalKernel<op, TypeTag::Rational, TypeTag::Rational>,
+          rationalKernel<op, TypeTag::Rational, TypeTag::BigInteger> },
+        { bigKernel<op, TypeTag::BigInteger, TypeTag::Integer>,
+          floatKernel<op, TypeTag::BigInteger, TypeTag::Float>,
+          rationalKernel<op, TypeTag::BigInteger, TypeTag::Rational>,
+          bigKernel<op, TypeTag::BigInteger, TypeTag::BigInteger> },
+    };
+};
+
+static const NumericKernel (*const NUMERIC_KERNELS[4])[4] = {
+    NumericKernels<ArithOp::Add>::table,
+    NumericKernels<ArithOp::Subtract>::table,
+    NumericKernels<ArithOp::Multiply>::table,
+    NumericKernels<ArithOp::Divide>::table,
+};
+
+// Row or column of a type in the tables, 4 for anything but a number
+static unsigned numericIndex(TypeTag tag) {
+    unsigned index = unsigned(tag) - unsigned(TypeTag::Integer);
+    return index < 4 ? index : 4;
+}
+
+// numericIndex() of a handle, reading its value into x if it is a number
+static unsigned readNumber(const ObPtr& value, Number& x) {
+    if (value.isInteger()) {
+        x = integerNumber(value.integerValue());
+        return 0;
+    }
+    if (value.isFloat()) {
+        x = floatNumber(value.floatValue());
+        return 1;
+    }
+    if (!value.isObject())
+        return 4;
+    unsigned index = numericIndex(value->tag());
+    if (index < 4)
+        x = numberOf(*value);
+    return index;
+}
+
+static NumericKernel numericKernel(ArithOp op, unsigned lhs, unsigned rhs) {
+    return NUMERIC_KERNELS[unsigned(op)][lhs][rhs];
+}
+
+// What the Integer and Float entries of the tables compute, for
+// arithmetic() to apply to the most common operands without an indirect
+// call. Indices are 0 for an Integer and 1 for a Float.
+template<ArithOp op>
+static ObPtr integerOrFloat(unsigned l, unsigned r, Number lhs, Number rhs) {
+    if ((l | r) == 0 && op != ArithOp::Divide)
+        return integerKernel<op>(lhs, rhs);
+    if (op == ArithOp::Divide && (r ? fabs(rhs.flt) < EPSILON : rhs.num == 0))
+        return nullptr;
+    return newFloat(applyDouble<op>(l ? lhs.flt : double(lhs.num),
+                                    r ? rhs.flt : double(rhs.num)));
+}
+
+static ObPtr integerOrFloat(ArithOp op, unsigned l, unsigned r,
+                            Number lhs, Number rhs) {
+    switch (op) {
+        case ArithOp::Add:      return integerOrFloat<ArithOp::Add>(l, r, lhs, rhs);
+        case ArithOp::Subtract: return integerOrFloat<ArithOp::Subtract>(l, r, lhs, rhs);
+        case ArithOp::Multiply: return integerOrFloat<ArithOp::Multiply>(l, r, lhs, rhs);
+        case ArithOp::Divide:   return integerOrFloat<ArithOp::Divide>(l, r, lhs, rhs);
+    }
+    return nullptr;
+}
+
+// The operators of the number types. A number times a Matrix or an
+// Nvector is left to the array operators.
+static ObPtr numericOperator(ArithOp op, const Object& lhs, const Object& rhs) {
+    unsigned r = numericIndex(rhs.tag());
+    if (r == 4) {
+        if (op == ArithOp::Multiply && (rhs.is<Nvector>() || rhs.is<Matrix>()))
+            return rhs * lhs;
+        throw TypeError(getInvalidOperandsTypeMsg(lhs, rhs));
+    }
+    ObPtr res = numericKernel(op, numericIndex(lhs.tag()), r)(
+        numberOf(lhs), numberOf(rhs));
+    if (!res)
+        throw DivisionByZero(lhs.repr() + " " + rhs.repr());
+    return res;
+}
+
 // Integer
 
 std::string Integer::repr() const {
@@ -148,9 +633,11 @@ ObPtr Integer::operator==(const Object& rhs) const {
     double l = int_;
     double r;
     if (rhs.is<Integer>())
-        l = rhs.as<Integer>()->value();
+        return newBool(int_ == rhs.as<Integer>()->value());
+    else if (rhs.is<BigInteger>())
+        return newFalse();
     else if (rhs.is<Float>())
-        r = rhs.as<Integer>()->value();
+        r = rhs.as<Float>()->value();
     else if (rhs.is<Rational>())
         r = rhs.as<Rational>()->value();
     else
@@ -161,6 +648,8 @@ ObPtr Integer::operator==(const Object& rhs) const {
 ObPtr Integer::operator<(const Object& rhs) const {
     if (rhs.is<Integer>())
         return newBool(int_ < rhs.as<Integer>()->value());
+    else if (rhs.is<BigInteger>())
+        return newBool(compare(BigInt(int_), rhs.as<BigInteger>()->value()) < 0);
     else if (rhs.is<Float>())
         return newBool(int_ < rhs.as<Float>()->value());
     else if (rhs.is<Rational>())
@@ -172,6 +661,8 @@ ObPtr Integer::operator<(const Object& rhs) const {
 ObPtr Integer::operator<=(const Object& rhs) const {
     if (rhs.is<Integer>())
         return newBool(int_ <= rhs.as<Integer>()->value());
+    else if (rhs.is<BigInteger>())
+        return newBool(compare(BigInt(int_), rhs.as<BigInteger>()->value()) <= 0);
     else if (rhs.is<Float>())
         return newBool(int_ <= rhs.as<Float>()->value());
     else if (rhs.is<Rational>())
@@ -189,68 +680,32 @@ ObPtr Integer::operator>=(const Object& rhs) const {
 }
 
 ObPtr Integer::operator+(const Object& rhs) const {
-    if (rhs.is<Integer>())
-        return newInteger(int_ + rhs.as<Integer>()->value());
-    else if (rhs.is<Float>())
-        return newFloat(int_ + rhs.as<Float>()->value());
-    else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        return newRational(int_ * r->denom() + r->numer(), r->denom());
-    }
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Add, *this, rhs);
 }
 
 ObPtr Integer::operator-(const Object& rhs) const {
-    if (rhs.is<Integer>())
-        return newInteger(int_ - rhs.as<Integer>()->value());
-    else if (rhs.is<Float>())
-        return newFloat(int_ - rhs.as<Float>()->value());
-    else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        return newRational(int_ * r->denom() - r->numer(), r->denom());
-    }
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Subtract, *this, rhs);
 }
 
 ObPtr Integer::operator*(const Object& rhs) const {
-    if (rhs.is<Integer>())
-        return newInteger(int_ * rhs.as<Integer>()->value());
-    else if (rhs.is<Float>())
-        return newFloat(int_ * rhs.as<Float>()->value());
-    else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        return newRational(int_ * r->numer(), r->denom());
-    }
-    else if (rhs.is<Nvector>() || rhs.is<Matrix>())
-        return rhs * *this;
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Multiply, *this, rhs);
 }
 
 ObPtr Integer::operator/(const Object& rhs) const {
-    if (rhs.is<Integer>()) {
-        int rval = rhs.as<Integer>()->value();
-        if (rval == 0)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newFloat(double(int_) / rval);
-    } else if (rhs.is<Float>()) {
-        double rval = rhs.as<Float>()->value();
-        if (rval < EPSILON)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newFloat(int_ / rval);
-    } else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        if (r->value() < EPSILON)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newRational(int_ * r->denom(), r->numer());
-    } else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Divide, *this, rhs);
 }
 
 // Float
 
+std::size_t Float::hash() const {
+    // Integral floats compare equal to Integers, so they must hash alike
+    double integral;
+    if (std::fpclassify(std::modf(float_, &integral)) == FP_ZERO &&
+            fabs(integral) < 9.2e18)
+        return std::hash<long long> {}((long long)integral);
+    return std::hash<double> {}(float_);
+}
+
 ObPtr Float::operator==(const Object& rhs) const {
     double l = float_;
     double r;
@@ -260,6 +715,8 @@ ObPtr Float::operator==(const Object& rhs) const {
         r = rhs.as<Float>()->value();
     else if (rhs.is<Rational>())
         r = rhs.as<Rational>()->value();
+    else if (rhs.is<BigInteger>())
+        r = rhs.as<BigInteger>()->asFlt();
     else
         return newFalse();
     return newBool(fabs(l - r) <= EPSILON);
@@ -272,6 +729,8 @@ ObPtr Float::operator<(const Object& rhs) const {
         return newBool(float_ < rhs.as<Float>()->value());
     else if (rhs.is<Rational>())
         return newBool(float_ < rhs.as<Rational>()->value());
+    else if (rhs.is<BigInteger>())
+        return newBool(float_ < rhs.as<BigInteger>()->asFlt());
     else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
@@ -283,6 +742,8 @@ ObPtr Float::operator<=(const Object& rhs) const {
         return newBool(float_ <= rhs.as<Float>()->value());
     else if (rhs.is<Rational>())
         return newBool(float_ <= rhs.as<Rational>()->value());
+    else if (rhs.is<BigInteger>())
+        return newBool(float_ <= rhs.as<BigInteger>()->asFlt());
     else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
@@ -300,77 +761,128 @@ std::string Float::repr() const {
 }
 
 ObPtr Float::operator+(const Object& rhs) const {
-    if (rhs.is<Integer>())
-        return newFloat(float_ + rhs.as<Integer>()->value());
-    else if (rhs.is<Float>())
-        return newFloat(float_ + rhs.as<Float>()->value());
-    else if (rhs.is<Rational>())
-        return newFloat(float_ + rhs.as<Rational>()->value());
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Add, *this, rhs);
 }
 
 ObPtr Float::operator-(const Object& rhs) const {
-    if (rhs.is<Integer>())
-        return newFloat(float_ - rhs.as<Integer>()->value());
-    else if (rhs.is<Float>())
-        return newFloat(float_ - rhs.as<Float>()->value());
-    else if (rhs.is<Rational>())
-        return newFloat(float_ - rhs.as<Rational>()->value());
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Subtract, *this, rhs);
 }
 
 ObPtr Float::operator*(const Object& rhs) const {
-    if (rhs.is<Integer>())
-        return newFloat(float_ * rhs.as<Integer>()->value());
-    else if (rhs.is<Float>())
-        return newFloat(float_ * rhs.as<Float>()->value());
-    else if (rhs.is<Rational>())
-        return newFloat(float_ * rhs.as<Rational>()->value());
-    else if (rhs.is<Nvector>() || rhs.is<Matrix>())
-        return rhs * *this;
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Multiply, *this, rhs);
 }
 
 ObPtr Float::operator/(const Object& rhs) const {
-    if (rhs.is<Integer>()) {
-        int rval = rhs.as<Integer>()->value();
-        if (rval == 0)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newFloat(float_ / rval);
-    } else if (rhs.is<Float>()) {
-        double rval = rhs.as<Float>()->value();
-        if (rval < EPSILON)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newFloat(float_ / rval);
-    } else if (rhs.is<Rational>()) {
-        double rval = rhs.as<Rational>()->value();
-        if (rval < EPSILON)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newFloat(float_ / rval);
-    }
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Divide, *this, rhs);
 }
 
 // Rational
 
-Rational::Rational(int num, int den) : numer_(num), denom_(den) {
+Rational::Rational(long long num, long long den)
+    : Numeric(TypeTag::Rational), numer_(num), denom_(den) {
     if (denom_ == 0)
         throw DivisionByZero("Denominator is zero");
-    if (denom_ < 0) {
-        denom_ = -denom_;
-        numer_ = -numer_;
-    }
     simplify_();
 };
 
+Rational::Rational(const BigInt& num, const BigInt& den)
+    : Numeric(TypeTag::Rational), numer_(0), denom_(1) {
+    if (den.isZero())
+        throw DivisionByZero("Denominator is zero");
+    BigInt g = BigInt::gcd(num, den);
+    if (den.isNegative())
+        g = -g;
+    store_(num / g, den / g);
+}
+
+Rational::Rational(const BigInt& num, const BigInt& den, Reduced)
+    : Numeric(TypeTag::Rational), numer_(0), denom_(1) {
+    store_(num, den);
+}
+
+void Rational::store_(const BigInt& num, const BigInt& den) {
+    if (num.fitsLongLong() && den.fitsLongLong()) {
+        numer_ = num.toLongLong();
+        denom_ = den.toLongLong();
+    } else
+        big_ = std::make_shared<const BigParts>(BigParts { num, den });
+}
+
+// The gcd is divided out before the sign is moved to the numerator, so
+// only LLONG_MIN over a negative denominator can leave long long
 void Rational::simplify_() {
-    long long g = gcd(numer_, denom_);
-    numer_ /= g;
-    denom_ /= g;
+    unsigned long long g = gcd(magnitude(numer_), magnitude(denom_));
+    if (g > (unsigned long long)LLONG_MAX) {
+        // LLONG_MIN over LLONG_MIN, or zero over it
+        numer_ = numer_ != 0;
+        denom_ = 1;
+        return;
+    }
+    numer_ /= (long long)g;
+    denom_ /= (long long)g;
+    if (denom_ > 0)
+        return;
+    if (numer_ == LLONG_MIN || denom_ == LLONG_MIN) {
+        big_ = std::make_shared<const BigParts>(
+            BigParts { -BigInt(numer_), -BigInt(denom_) });
+        return;
+    }
+    numer_ = -numer_;
+    denom_ = -denom_;
+}
+
+double Rational::value() const {
+    if (big_)
+        return BigInt::ratio(big_->numer, big_->denom);
+    return double(numer_) / denom_;
+}
+
+Rational::operator bool() const {
+    if (big_)
+        return !big_->numer.isNegative() && !big_->numer.isZero();
+    return numer_ > 0;
+}
+
+// Largest numerator a double holds exactly
+const static long long DOUBLE_EXACT = 1LL << 53;
+
+// Whether num / den, in lowest terms, is exactly a double: the
+// numerator fits the mantissa and the denominator is a power of two
+static bool isDyadic(long long num, long long den) {
+    return num > -DOUBLE_EXACT && num < DOUBLE_EXACT && (den & (den - 1)) == 0;
+}
+
+static bool isDyadic(const BigInt& num, const BigInt& den) {
+    if (!num.fitsLongLong() || !isDyadic(num.toLongLong(), 1))
+        return false;
+    static const BigInt two(2);
+    BigInt rest = den;
+    while (rest != BigInt(1)) {
+        BigInt quot, rem;
+        BigInt::divMod(rest, two, quot, rem);
+        if (!rem.isZero())
+            return false;
+        rest = std::move(quot);
+    }
+    return true;
+}
+
+std::size_t Rational::hash() const {
+    // A value that is exactly a double hashes like the Float it equals
+    if (big_) {
+        // A whole number hashes like the BigInteger it equals
+        if (big_->denom == BigInt(1))
+            return std::hash<double> {}(big_->numer.toDouble());
+        if (isDyadic(big_->numer, big_->denom))
+            return std::hash<double> {}(BigInt::ratio(big_->numer, big_->denom));
+        return hashCombine(big_->numer.hash(), big_->denom.hash());
+    }
+    if (denom_ == 1)
+        return std::hash<long long> {}(numer_);
+    if (isDyadic(numer_, denom_))
+        return std::hash<double> {}(double(numer_) / denom_);
+    return hashCombine(std::hash<long long> {}(numer_),
+                       std::hash<long long> {}(denom_));
 }
 
 ObPtr Rational::operator==(const Object& rhs) const {
@@ -382,6 +894,8 @@ ObPtr Rational::operator==(const Object& rhs) const {
         r = rhs.as<Float>()->value();
     else if (rhs.is<Rational>())
         r = rhs.as<Rational>()->value();
+    else if (rhs.is<BigInteger>())
+        r = rhs.as<BigInteger>()->asFlt();
     else
         return newFalse();
     return newBool(fabs(l - r) <= EPSILON);
@@ -394,6 +908,8 @@ ObPtr Rational::operator<(const Object& rhs) const {
         return newBool(value() < rhs.as<Float>()->value());
     else if (rhs.is<Rational>())
         return newBool(value() < rhs.as<Rational>()->value());
+    else if (rhs.is<BigInteger>())
+        return newBool(value() < rhs.as<BigInteger>()->asFlt());
     else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
@@ -405,6 +921,8 @@ ObPtr Rational::operator<=(const Object& rhs) const {
         return newBool(value() <= rhs.as<Float>()->value());
     else if (rhs.is<Rational>())
         return newBool(value() <= rhs.as<Rational>()->value());
+    else if (rhs.is<BigInteger>())
+        return newBool(value() <= rhs.as<BigInteger>()->asFlt());
     else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
@@ -418,6 +936,11 @@ ObPtr Rational::operator>=(const Object& rhs) const {
 }
 
 std::string Rational::repr() const {
+    if (big_) {
+        if (big_->denom == BigInt(1))
+            return big_->numer.toString();
+        return big_->numer.toString() + '/' + big_->denom.toString();
+    }
     if (denom_ != 1)
         return std::to_string(numer_) + '/' + std::to_string(denom_);
     else
@@ -425,89 +948,131 @@ std::string Rational::repr() const {
 }
 
 ObPtr Rational::operator+(const Object& rhs) const {
-    if (rhs.is<Integer>()) {
-        auto r = rhs.as<Integer>();
-        return newRational(numer_ + r->value() * denom_, denom_);
-    }
-    else if (rhs.is<Float>())
-        return newFloat(value() + rhs.as<Float>()->value());
-    else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        return newRational(numer_ * r->denom_ + r->numer_ * denom_,
-                           denom_ * r->denom_);
-    }
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Add, *this, rhs);
 }
 
 ObPtr Rational::operator-(const Object& rhs) const {
-    if (rhs.is<Integer>()) {
-        auto r = rhs.as<Integer>();
-        return newRational(numer_ - r->value() * denom_, denom_);
-    }
-    else if (rhs.is<Float>())
-        return newFloat(value() - rhs.as<Float>()->value());
-    else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        return newRational(numer_ * r->denom_ - r->numer_ * denom_,
-                           denom_ * r->denom_);
-    }
-    else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return numericOperator(ArithOp::Subtract, *this, rhs);
 }
 
 ObPtr Rational::operator*(const Object& rhs) const {
+    return numericOperator(ArithOp::Multiply, *this, rhs);
+}
+
+ObPtr Rational::operator/(const Object& rhs) const {
+    return numericOperator(ArithOp::Divide, *this, rhs);
+}
+
+
+// BigInteger
+
+std::size_t BigInteger::hash() const {
+    // Equal to Floats of the same value, which hash their doubles
+    return std::hash<double> {}(int_.toDouble());
+}
+
+ObPtr BigInteger::operator==(const Object& rhs) const {
+    if (rhs.is<BigInteger>())
+        return newBool(int_ == rhs.as<BigInteger>()->value());
     if (rhs.is<Integer>())
-        return newRational(numer_ * rhs.as<Integer>()->value(), denom_);
-    else if (rhs.is<Float>())
-        return newFloat(value() * rhs.as<Float>()->value());
-    else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        return newRational(numer_ * r->numer_, denom_ * r->denom_);
-    }
-    else if (rhs.is<Nvector>() || rhs.is<Matrix>())
-        return rhs * *this;
+        return newFalse();
+    if (rhs.is<Float>() || rhs.is<Rational>())
+        return newBool(fabs(asFlt() - rhs.as<Numeric>()->asFlt()) <= EPSILON);
+    return newFalse();
+}
+
+ObPtr BigInteger::operator<(const Object& rhs) const {
+    if (rhs.is<BigInteger>())
+        return newBool(int_ < rhs.as<BigInteger>()->value());
+    else if (rhs.is<Integer>())
+        return newBool(compare(int_, BigInt(rhs.as<Integer>()->value())) < 0);
+    else if (rhs.is<Numeric>())
+        return newBool(asFlt() < rhs.as<Numeric>()->asFlt());
     else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
 
-ObPtr Rational::operator/(const Object& rhs) const {
-    if (rhs.is<Integer>()) {
-        int rval = rhs.as<Integer>()->value();
-        if (rval == 0)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newRational(numer_, denom_ * rval);
-    } else if (rhs.is<Float>()) {
-        double rval = rhs.as<Float>()->value();
-        if (rval < EPSILON)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newFloat(value() / rval);
-    } else if (rhs.is<Rational>()) {
-        auto r = rhs.as<Rational>();
-        if (r->value() < EPSILON)
-            throw DivisionByZero(repr() + " " + rhs.repr());
-        return newRational(numer_ * r->denom_, denom_ * r->numer_);
-    }
+ObPtr BigInteger::operator<=(const Object& rhs) const {
+    if (rhs.is<BigInteger>())
+        return newBool(compare(int_, rhs.as<BigInteger>()->value()) <= 0);
+    else if (rhs.is<Integer>())
+        return newBool(compare(int_, BigInt(rhs.as<Integer>()->value())) <= 0);
+    else if (rhs.is<Numeric>())
+        return newBool(asFlt() <= rhs.as<Numeric>()->asFlt());
     else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
 
+ObPtr BigInteger::operator>(const Object& rhs) const {
+    return !*(*this <= rhs);
+}
+
+ObPtr BigInteger::operator>=(const Object& rhs) const {
+    return !*(*this < rhs);
+}
+
+ObPtr BigInteger::operator+(const Object& rhs) const {
+    return numericOperator(ArithOp::Add, *this, rhs);
+}
+
+ObPtr BigInteger::operator-(const Object& rhs) const {
+    return numericOperator(ArithOp::Subtract, *this, rhs);
+}
+
+ObPtr BigInteger::operator*(const Object& rhs) const {
+    return numericOperator(ArithOp::Multiply, *this, rhs);
+}
+
+ObPtr BigInteger::operator/(const Object& rhs) const {
+    return numericOperator(ArithOp::Divide, *this, rhs);
+}
+
 
 // Sequence
 
 Sequence::~Sequence() { };
 
+std::size_t Sequence::hash() const {
+    if (!hashed_) {
+        std::size_t seed = size();
+        for (auto& e : *this)
+            seed = hashCombine(seed, e->hash());
+        hash_ = seed;
+        hashed_ = true;
+    }
+    return hash_;
+}
+
+ObPtr Sequence::operator==(const Object& rhs) const {
+    const Sequence* right = rhs.as<Sequence>();
+    if (right) {
+        if (size() != right->size())
+            return newFalse();
+        // A vector and its copies share their nodes
+        if (is<Vector>() && right->is<Vector>() &&
+                as<Vector>()->items().sameAs(right->as<Vector>()->items()))
+            return newTrue();
+        for (auto l = begin(), r = right->begin(); l != end(); ++l, ++r)
+            if (*(**l != **r))
+                return newFalse();
+        return newTrue();
+    } else {
+        return newFalse();
+    }
+}
+
 // List
 
 void List::push(ObPtr valuePtr) {
-    vector_.push_back(valuePtr);
+    items_.push_back(valuePtr);
+    hashed_ = false;
 }
 
 std::string List::repr() const {
-    if (vector_.empty())
+    if (items_.empty())
         return "()";
     std::string out = "(";
-    for (auto &val : vector_) {
+    for (auto &val : items_) {
         out.append(val->repr());
         out.append(" ");
     }
@@ -517,15 +1082,19 @@ std::string List::repr() const {
 
 // Vector
 
-void Vector::push(ObPtr valuePtr) {
-    vector_.push_back(valuePtr);
+Vector::Vector(SequenceConstIter begin, SequenceConstIter end)
+    : Sequence(TypeTag::Vector) {
+    PersistentVector::Builder builder;
+    for (auto it = begin; it != end; ++it)
+        builder.push(*it);
+    items_ = builder.persistent();
 }
 
 std::string Vector::repr() const {
-    if (vector_.empty())
+    if (items_.empty())
         return "[]";
     std::string out = "[";
-    for (auto &val : vector_) {
+    for (auto &val : *this) {
         out.append(val->repr());
         out.append(" ");
     }
@@ -533,59 +1102,49 @@ std::string Vector::repr() const {
     return out;
 }
 
-ObPtr Sequence::operator==(const Object& rhs) const {
-    const Sequence* right = rhs.as<Sequence>();
-    if (right) {
-        int lsize = size();
-        int rsize = right->size();
-        if (lsize != rsize)
-            return newFalse();
-        else {
-            for (int i = 0; i < std::min(lsize, rsize); i++)
-                if (*(*at(i) != *right->at(i)))
-                    return newFalse();
-        }
-        return newTrue();
-    } else {
-        return newFalse();
-    }
-}
-
 // HashMap
 
 std::string HashMap::repr() const {
-    if (map_.empty())
+    if (items_.empty())
         return "{}";
     std::string out = "{";
-    for (auto &pair : map_) {
-        out.append(pair.first->repr());
+    for (auto& entry : items_) {
+        out.append(entry.key->repr());
         out.append(" ");
-        out.append(pair.second->repr());
+        out.append(entry.value->repr());
         out.append(" ");
     }
     out[out.size() - 1] = '}';
     return out;
 }
 
-void HashMap::set(ObPtr key, ObPtr val) {
-    map_[key] = val;
+std::size_t HashMap::hash() const {
+    if (!hashed_) {
+        // Order independent: iteration order depends on the key hashes
+        std::size_t seed = items_.size();
+        for (auto& entry : items_)
+            seed += hashCombine(entry.hash, entry.value->hash());
+        hash_ = seed;
+        hashed_ = true;
+    }
+    return hash_;
 }
 
-ObPtr HashMap::get(ObPtr key) {
-    if (map_.find(key) != map_.end())
-        return map_.at(key);
-    return nullptr;
+void HashMap::set(ObPtr key, ObPtr val) {
+    PersistentMap::Builder items(std::move(items_));
+    items.set(std::move(key), std::move(val));
+    items_ = items.persistent();
+    hashed_ = false;
 }
 
-ObPtr HashMap::get(ObPtr key) const {
-    if (map_.find(key) != map_.end())
-        return map_.at(key);
-    return nullptr;
+ObPtr HashMap::get(const ObPtr& key) const {
+    const ObPtr* value = items_.find(key);
+    return value ? *value : nullptr;
 }
 
 ObPtr HashMap::operator==(const Object& rhs) const {
     if (rhs.as<HashMap>())
-        return newBool(map_ == rhs.as<HashMap>()->map_);
+        return newBool(items_ == rhs.as<HashMap>()->items_);
     return newFalse();
 }
 
@@ -593,7 +1152,7 @@ ObPtr HashMap::operator==(const Object& rhs) const {
 Bool::~Bool() { };
 
 ObPtr Bool::operator==(const Object& rhs) const {
-    if (rhs.as<Bool>())
+    if (rhs.is<Bool>())
         return newBool((bool(*this) == bool(rhs)));
     return newFalse();
 }
@@ -601,7 +1160,7 @@ ObPtr Bool::operator==(const Object& rhs) const {
 // Nil
 
 ObPtr Nil::operator==(const Object& rhs) const {
-    if (rhs.as<Nil>())
+    if (rhs.is<Nil>())
         return newTrue();
     return newFalse();
 }
@@ -610,126 +1169,105 @@ ObPtr Nil::operator==(const Object& rhs) const {
 
 
 std::string Nvector::repr() const {
-    if (data_.empty())
+    if (data_->empty())
         return "[]";
     std::string out;
     out += '[';
-    for (auto& e : data_)
+    for (auto& e : *data_)
         out += std::to_string(e) + " ";
     out[out.size() - 1] = ']';
     return out;
 }
 
+void Nvector::makeUnique() {
+    if (!uniqueBuffer())
+        data_ = std::make_shared<DoubleBuffer>(*data_);
+}
+
+std::size_t Nvector::hash() const {
+    std::size_t seed = data_->size();
+    for (auto& e : *data_)
+        seed = hashCombine(seed, std::hash<double> {}(e));
+    return seed;
+}
+
 ObPtr Nvector::operator==(const Object& rhs) const {
+    if (rhs.is<LazyExpr>())
+        return rhs == *this;
     const Nvector* right = rhs.as<Nvector>();
     if (!right)
         return newFalse();
     if (size() != right->size())
         return newFalse();
     for (int i = 0; i < size(); i++) 
-        if (fabs(data_.at(i) - right->at(i)) < EPSILON)
+        if (fabs(data_->at(i) - right->at(i)) < EPSILON)
             return newFalse();
     return newTrue();
 }
 
-ObPtr Nvector::operator+(const Object& rhs) const {
+// Nvector op Nvector of the same size, or Nvector op scalar
+static ObPtr nvectorArithmetic(ArithOp op, const Nvector& lhs,
+                               const Object& rhs) {
     if (rhs.is<Nvector>()) {
         const Nvector* right = rhs.as<Nvector>();
-        if (!right)
-            throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
-
-        ObPtr res = newNvector();
-        if (size() != right->size())
+        if (lhs.size() != right->size())
             throw ValueError("NVectors must me the same size");
-
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) + right->at(i));
+        if (op == ArithOp::Divide)
+            for (int i = 0; i < right->size(); i++)
+                if (fabs(right->data()[i]) < EPSILON)
+                    throw DivisionByZero("Zero");
+        ObPtr res = newNvector(lhs.size());
+        simdCombine(op, lhs.data(), right->data(),
+                    res->as<Nvector>()->data(), lhs.size());
         return res;
     } else if (rhs.is<Numeric>()) {
         auto val = rhs.as<Numeric>()->asFlt();
-        ObPtr res = newNvector();
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) + val);
+        if (op == ArithOp::Divide && fabs(val) < EPSILON)
+            throw DivisionByZero("Zero");
+        ObPtr res = newNvector(lhs.size());
+        simdCombine(op, lhs.data(), val, res->as<Nvector>()->data(),
+                    lhs.size());
         return res;
     } else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+        throw TypeError(getInvalidOperandsTypeMsg(lhs, rhs));
 }
 
-ObPtr Nvector::operator-(const Object& rhs) const {
-    if (rhs.is<Nvector>()) {
-        const Nvector* right = rhs.as<Nvector>();
-        if (!right)
-            throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
-
-        ObPtr res = newNvector();
-        if (size() != right->size())
-            throw ValueError("NVectors must me the same size");
+ObPtr Nvector::operator+(const Object& rhs) const {
+    return nvectorArithmetic(ArithOp::Add, *this, rhs);
+}
 
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) - right->at(i));
-        return res;
-    } else if (rhs.is<Numeric>()) {
-        auto val = rhs.as<Numeric>()->asFlt();
-        ObPtr res = newNvector();
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) - val);
-        return res;
-    } else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+ObPtr Nvector::operator-(const Object& rhs) const {
+    return nvectorArithmetic(ArithOp::Subtract, *this, rhs);
 }
 
 ObPtr Nvector::operator*(const Object& rhs) const {
-    if (rhs.is<Nvector>()) {
-        const Nvector* right = rhs.as<Nvector>();
-        if (!right)
-            throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
-
-        ObPtr res = newNvector();
-        if (size() != right->size())
-            throw ValueError("NVectors must me the same size");
-
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) * right->at(i));
-        return res;
-    } else if (rhs.is<Numeric>()) {
-        auto val = rhs.as<Numeric>()->asFlt();
-        ObPtr res = newNvector();
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) * val);
-        return res;
-    } else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return nvectorArithmetic(ArithOp::Multiply, *this, rhs);
 }
 
 ObPtr Nvector::operator/(const Object& rhs) const {
-    if (rhs.is<Nvector>()) {
-        const Nvector* right = rhs.as<Nvector>();
-        if (!right)
-            throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+    return nvectorArithmetic(ArithOp::Divide, *this, rhs);
+}
 
-        ObPtr res = newNvector();
-        if (size() != right->size())
-            throw ValueError("NVectors must me the same size");
+// Matrix
 
-        for (int i = 0; i < size(); i++) {
-            if (right->at(i) < EPSILON)
-                throw DivisionByZero("Zero");
-            res->as<Nvector>()->push(data_.at(i) / right->at(i));
-        }
-        return res;
-    } else if (rhs.is<Numeric>()) {
-        auto val = rhs.as<Numeric>()->asFlt();
-        if (val < EPSILON)
-            throw DivisionByZero("Zero");
-        ObPtr res = newNvector();
-        for (int i = 0; i < size(); i++)
-            res->as<Nvector>()->push(data_.at(i) / val);
-        return res;
-    } else
-        throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
+// Doubles per 32 bytes, the widest vector register width in use
+const static int ROW_ALIGNMENT = 4;
+
+// Row stride for n columns, checking the sizes before any buffer is made
+static int rowStride(int m, int n) {
+    if (m < 0 || n < 0)
+        throw ValueError("Matrix sizes must be non-negative");
+    return (n + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
 }
 
-// Matrix
+Matrix::Matrix(int m, int n)
+    : Object(TypeTag::Matrix), m_(m), n_(n), stride_(rowStride(m, n)),
+      data_(std::make_shared<DoubleBuffer>(std::size_t(m) * stride_, 0.0)) { }
+
+void Matrix::makeUnique() {
+    if (!uniqueBuffer())
+        data_ = std::make_shared<DoubleBuffer>(*data_);
+}
 
 std::string Matrix::typeRepr() const {
     return "Matrix(" + std::to_string(m()) + "," + std::to_string(n()) + ")";
@@ -744,8 +1282,9 @@ std::string Matrix::repr() const {
 		maxWidthPerCol[j] = maxWidthInCol(*this, j);
 
     for (int i = 0; i < m(); i++) {
+        const double* row = (*this)[i];
         for (int j = 0; j < n(); j++)
-            out << std::setw(maxWidthPerCol[j]) << data_[i][j] << " ";
+            out << std::setw(maxWidthPerCol[j]) << row[j] << " ";
         out << "\n ";
     }
     std::string res = out.str();
@@ -754,103 +1293,104 @@ std::string Matrix::repr() const {
     return res;
 };
 
+std::size_t Matrix::hash() const {
+    std::size_t seed = hashCombine(m(), n());
+    for (int i = 0; i < m(); i++) {
+        const double* row = (*this)[i];
+        for (int j = 0; j < n(); j++)
+            seed = hashCombine(seed, std::hash<double> {}(row[j]));
+    }
+    return seed;
+}
 
 ObPtr Matrix::operator==(const Object& rhs) const {
+    if (rhs.is<LazyExpr>())
+        return rhs == *this;
     const Matrix* right = rhs.as<Matrix>();
     if (right->m() != m() || right->n() != n())
         return newFalse();
     for (int i = 0; i < m(); i++) {
+        const double* lrow = (*this)[i];
+        const double* rrow = (*right)[i];
         for (int j = 0; j < n(); j++) {
-            if (fabs(data_[i][j] - (*right)[i][j]) > EPSILON)
+            if (fabs(lrow[j] - rrow[j]) > EPSILON)
                 return newFalse();
         }
     }
     return newTrue();
 }
 
-ObPtr Matrix::operator+(const Object& rhs) const {
-    const Matrix* right = rhs.as<Matrix>();
-    if (right->m() != m() || right->n() != n())
-        return newFalse();
-    ObPtr res = newMatrix();
+// Applies op to each pair of elements of two matrices of the same shape
+template<typename Op>
+static ObPtr matrixElementwise(const Matrix& lhs, const Matrix& rhs, Op op) {
+    if (rhs.m() != lhs.m() || rhs.n() != lhs.n())
+        throw ValueError("Matrices must be the same size");
+    ObPtr res = newMatrix(lhs.m(), lhs.n());
     Matrix* resM = res->as<Matrix>();
-    for (int i = 0; i < m(); i++) {
-        resM->addEmptyRow();
-        for (int j = 0; j < n(); j++)
-            (*resM)[i].push(data_[i][j] + (*right)[i][j]);
-    }
+    threadPool().parallelFor(0, lhs.m(), parallelRowGrain(lhs.n()),
+                             [&](long lo, long hi) {
+        for (long i = lo; i < hi; i++) {
+            const double* l = lhs[i];
+            const double* r = rhs[i];
+            double* out = (*resM)[i];
+            for (int j = 0; j < lhs.n(); j++)
+                out[j] = op(l[j], r[j]);
+        }
+    });
     return res;
 }
 
-ObPtr Matrix::operator-(const Object& rhs) const {
-    const Matrix* right = rhs.as<Matrix>();
-    if (right->m() != m() || right->n() != n())
-        return newFalse();
-    ObPtr res = newMatrix();
+// Applies op to each element of a matrix and a scalar
+template<typename Op>
+static ObPtr matrixScalar(const Matrix& lhs, double val, Op op) {
+    ObPtr res = newMatrix(lhs.m(), lhs.n());
     Matrix* resM = res->as<Matrix>();
-    for (int i = 0; i < m(); i++) {
-        resM->addEmptyRow();
-        for (int j = 0; j < n(); j++)
-            (*resM)[i].push(data_[i][j] - (*right)[i][j]);
-    }
+    threadPool().parallelFor(0, lhs.m(), parallelRowGrain(lhs.n()),
+                             [&](long lo, long hi) {
+        for (long i = lo; i < hi; i++) {
+            const double* l = lhs[i];
+            double* out = (*resM)[i];
+            for (int j = 0; j < lhs.n(); j++)
+                out[j] = op(l[j], val);
+        }
+    });
     return res;
 }
 
+ObPtr Matrix::operator+(const Object& rhs) const {
+    return matrixElementwise(*this, *rhs.as<Matrix>(),
+                             [](double l, double r) { return l + r; });
+}
+
+ObPtr Matrix::operator-(const Object& rhs) const {
+    return matrixElementwise(*this, *rhs.as<Matrix>(),
+                             [](double l, double r) { return l - r; });
+}
+
 ObPtr Matrix::operator*(const Object& rhs) const {
-    if (rhs.is<Matrix>()) {
-        const Matrix* right = rhs.as<Matrix>();
-        if (right->m() != m() || right->n() != n())
-            return newFalse();
-        ObPtr res = newMatrix();
-        Matrix* resM = res->as<Matrix>();
-        for (int i = 0; i < m(); i++) {
-            resM->addEmptyRow();
-            for (int j = 0; j < n(); j++)
-                (*resM)[i].push(data_[i][j] * (*right)[i][j]);
-        }
-        return res;
-    } else if (rhs.is<Numeric>()) {
-        auto val = rhs.as<Numeric>()->asFlt();
-        ObPtr res = newMatrix();
-        Matrix* resM = res->as<Matrix>();
-        for (int i = 0; i < m(); i++) {
-            resM->addEmptyRow();
-            for (int j = 0; j < n(); j++)
-                (*resM)[i].push(data_[i][j] * val);
-        }
-        return res;
-    } else
+    auto mul = [](double l, double r) { return l * r; };
+    if (rhs.is<Matrix>())
+        return matrixElementwise(*this, *rhs.as<Matrix>(), mul);
+    else if (rhs.is<Numeric>())
+        return matrixScalar(*this, rhs.as<Numeric>()->asFlt(), mul);
+    else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
 
 ObPtr Matrix::operator/(const Object& rhs) const {
     if (rhs.is<Matrix>()) {
-        const Matrix* right = rhs.as<Matrix>();
-        if (right->m() != m() || right->n() != n())
-            return newFalse();
-        ObPtr res = newMatrix();
-        Matrix* resM = res->as<Matrix>();
-        for (int i = 0; i < m(); i++) {
-            resM->addEmptyRow();
-            for (int j = 0; j < n(); j++) {
-                if ((*right)[i][j] < EPSILON)
+        return matrixElementwise(*this, *rhs.as<Matrix>(),
+            [](double l, double r) {
+                if (fabs(r) < EPSILON)
                     throw DivisionByZero("Zero");
-                (*resM)[i].push(data_[i][j] / (*right)[i][j]);
-            }
-        }
-        return res;
+                return l / r;
+            });
     } else if (rhs.is<Numeric>()) {
         auto val = rhs.as<Numeric>()->asFlt();
-        if (val < EPSILON)
+        if (fabs(val) < EPSILON)
             throw DivisionByZero("Zero");
-        ObPtr res = newMatrix();
-        Matrix* resM = res->as<Matrix>();
-        for (int i = 0; i < m(); i++) {
-            resM->addEmptyRow();
-            for (int j = 0; j < n(); j++)
-                (*resM)[i].push(data_[i][j] * val);
-        }
-        return res;
+        return matrixScalar(*this, val,
+                            [](double l, double r) { return l / r; });
     } else
         throw TypeError(getInvalidOperandsTypeMsg(*this, rhs));
 }
@@ -858,18 +1398,401 @@ ObPtr Matrix::operator/(const Object& rhs) const {
 ObPtr Matrix::dot(const Matrix& rhs) const {
     if (n() != rhs.m())
         throw ValueError("Matrix sizes don't match");
-    ObPtr res = newMatrix();
+    ObPtr res = newMatrix(m(), rhs.n());
     Matrix* resM = res->as<Matrix>();
-    for (int i = 0; i < m(); i++) {
-        resM->addEmptyRow();
-        for (int j = 0; j < rhs.n(); j++) {
-            double prod = 0;
-            for (int k = 0; k < n(); k++)
-                prod += data_[i][k] * rhs[k][j];
-            (*resM)[i].push(prod);
+    gemm(m(), rhs.n(), n(), data(), stride(), rhs.data(), rhs.stride(),
+         resM->data(), resM->stride());
+    return res;
+}
+
+// LazyExpr
+
+// Columns evaluated per step, so the row blocks of a segment stay in L1
+const static int LAZY_BLOCK = 512;
+
+struct ArrayShape {
+    int m;
+    int n;
+    bool vector;
+};
+
+static bool isArray(const Object& value) {
+    return value.is<Matrix>() || value.is<Nvector>() || value.is<LazyExpr>();
+}
+
+static ArrayShape shapeOf(const Object& value) {
+    if (value.is<Matrix>()) {
+        const Matrix* mat = value.as<Matrix>();
+        return { mat->m(), mat->n(), false };
+    }
+    if (value.is<Nvector>())
+        return { 1, value.as<Nvector>()->size(), true };
+    const LazyExpr* expr = value.as<LazyExpr>();
+    return { expr->m(), expr->n(), expr->isVector() };
+}
+
+LazyExpr::LazyExpr(ArithOp op, ObPtr lhs, ObPtr rhs, double scalar)
+    : Object(TypeTag::LazyExpr), op_(op), lhs_(lhs), rhs_(rhs),
+      scalar_(scalar) {
+    ArrayShape shape = shapeOf(*lhs_);
+    m_ = shape.m;
+    n_ = shape.n;
+    vector_ = shape.vector;
+    int left = lhs_.is<LazyExpr>() ? lhs_->as<LazyExpr>()->scratch() : 0;
+    int right = rhs_ && rhs_.is<LazyExpr>()
+        ? rhs_->as<LazyExpr>()->scratch() + 1 : 0;
+    scratch_ = std::max(left, right);
+}
+
+std::string LazyExpr::typeRepr() const {
+    if (vector_)
+        return "<Nvector>";
+    return "Matrix(" + std::to_string(m()) + "," + std::to_string(n()) + ")";
+}
+
+ObPtr LazyExpr::operator==(const Object& rhs) const {
+    if (rhs.is<LazyExpr>())
+        return *force() == *rhs.as<LazyExpr>()->force();
+    return *force() == rhs;
+}
+
+// Elements [j0, j0 + len) of row i of operand: a view into a Matrix or
+// Nvector, or a LazyExpr evaluated into out
+const double* LazyExpr::segment(const Object& operand, int i, int j0,
+                                int len, double* out, double* scratch) {
+    if (operand.is<Matrix>())
+        return (*operand.as<Matrix>())[i] + j0;
+    if (operand.is<Nvector>())
+        return operand.as<Nvector>()->data() + j0;
+    const LazyExpr* expr = operand.as<LazyExpr>();
+    if (expr->forced_)
+        return segment(*expr->forced_, i, j0, len, out, scratch);
+    expr->evaluate(i, j0, len, out, scratch);
+    return out;
+}
+
+// The left subtree is evaluated into out and the right one into the
+// first scratch block, with the blocks after it left to its subtrees
+void LazyExpr::evaluate(int i, int j0, int len,
+                        double* out, double* scratch) const {
+    const double* l = segment(*lhs_, i, j0, len, out, scratch);
+    if (!rhs_)
+        return simdCombine(op_, l, scalar_, out, len);
+    const double* r = segment(*rhs_, i, j0, len, scratch, scratch + LAZY_BLOCK);
+    simdCombine(op_, l, r, out, len);
+}
+
+// The leftmost leaf, when nothing outside this tree can see it or its
+// buffer: the result is then written over it instead of a new buffer.
+// Every other read of the leaf happens at the same position just before
+// the write, so evaluating in place is safe.
+ObPtr LazyExpr::reusableLeaf() const {
+    const ObPtr* operand = &lhs_;
+    while ((*operand).is<LazyExpr>()) {
+        const LazyExpr* node = (*operand)->as<LazyExpr>();
+        if (operand->use_count() != 1 || node->forced_)
+            return nullptr;
+        operand = &node->lhs_;
+    }
+    const ObPtr& leaf = *operand;
+    bool unique = leaf.is<Matrix>() ? leaf->as<Matrix>()->uniqueBuffer()
+                                     : leaf->as<Nvector>()->uniqueBuffer();
+    return unique && leaf.use_count() == 1 ? leaf : nullptr;
+}
+
+const ObPtr& LazyExpr::force() const {
+    if (forced_)
+        return forced_;
+
+    ObPtr res = reusableLeaf();
+    if (!res)
+        res = vector_ ? newNvector(n_) : newMatrix(m_, n_);
+    double* base = vector_ ? res->as<Nvector>()->data()
+                           : res->as<Matrix>()->data();
+    long stride = vector_ ? n_ : res->as<Matrix>()->stride();
+    long blocks = (n_ + LAZY_BLOCK - 1) / LAZY_BLOCK;
+    threadPool().parallelFor(0, m_ * blocks, PARALLEL_GRAIN / LAZY_BLOCK,
+                             [&](long lo, long hi) {
+        std::vector<double> scratch(std::size_t(scratch_) * LAZY_BLOCK);
+        for (long s = lo; s < hi; s++) {
+            int i = s / blocks;
+            int j0 = s % blocks * LAZY_BLOCK;
+            int len = std::min(LAZY_BLOCK, n_ - j0);
+            evaluate(i, j0, len, base + i * stride + j0, scratch.data());
         }
+    });
+
+    // Dropping the tree releases operands only it was keeping alive
+    forced_ = res;
+    lhs_.reset();
+    rhs_.reset();
+    return forced_;
+}
+
+// Operand as stored in a tree. A forced LazyExpr stands for its result;
+// Matrix and Nvector leaves are new objects sharing the operand's
+// buffer, so writing in place to the operand copies it first, and a
+// temporary's buffer is left to the tree alone once the temporary dies.
+static ObPtr lazyOperand(const ObPtr& value) {
+    const ObPtr& settled = value.is<LazyExpr>() && value->as<LazyExpr>()->isForced()
+        ? value->as<LazyExpr>()->force() : value;
+    if (settled.is<Matrix>())
+        return settled->as<Matrix>()->share();
+    if (settled.is<Nvector>())
+        return settled->as<Nvector>()->share();
+    return settled;
+}
+
+static void checkDivisor(const Object& divisor) {
+    ArrayShape shape = shapeOf(divisor);
+    for (int i = 0; i < shape.m; i++) {
+        const double* row = shape.vector ? divisor.as<Nvector>()->data()
+                                         : (*divisor.as<Matrix>())[i];
+        for (int j = 0; j < shape.n; j++)
+            if (fabs(row[j]) < EPSILON)
+                throw DivisionByZero("Zero");
     }
-    return res;
+}
+
+static ObPtr applyEager(ArithOp op, const Object& lhs, const Object& rhs) {
+    switch (op) {
+        case ArithOp::Add:      return lhs + rhs;
+        case ArithOp::Subtract: return lhs - rhs;
+        case ArithOp::Multiply: return lhs * rhs;
+        case ArithOp::Divide:   return lhs / rhs;
+    }
+    throw ValueError("Bad arithmetic operation");
+}
+
+// arithmetic() for anything but Integers and Floats, and for their
+// errors. l and r are the numericIndex() of the operands, a and b their
+// values if they are numbers. Kept out of line so that arithmetic() stays
+// small.
+__attribute__((noinline))
+static ObPtr generalArithmetic(ArithOp op, const ObPtr& lhs, const ObPtr& rhs,
+                               unsigned l, unsigned r, Number a, Number b) {
+    if (l < 4 && r < 4) {
+        ObPtr res = numericKernel(op, l, r)(a, b);
+        if (!res)
+            throw DivisionByZero(lhs->repr() + " " + rhs->repr());
+        return res;
+    }
+    bool lhsArray = isArray(*lhs);
+    bool rhsArray = isArray(*rhs);
+    if (!lhsArray && !rhsArray)
+        return applyEager(op, *lhs, *rhs);
+
+    // Scalars on the left are only defined for *, which commutes
+    if (!lhsArray && op == ArithOp::Multiply && lhs.is<Numeric>())
+        return arithmetic(op, rhs, lhs);
+
+    if (lhsArray && rhs.is<Numeric>()) {
+        // Matrices take only * and / with a scalar, Nvectors all four
+        bool defined = shapeOf(*lhs).vector || op == ArithOp::Multiply ||
+                       op == ArithOp::Divide;
+        if (defined) {
+            double val = rhs->as<Numeric>()->asFlt();
+            if (op == ArithOp::Divide && fabs(val) < EPSILON)
+                throw DivisionByZero("Zero");
+            return ObPtr(new LazyExpr(op, lazyOperand(lhs), nullptr, val));
+        }
+    }
+
+    if (lhsArray && rhsArray) {
+        ArrayShape l = shapeOf(*lhs);
+        ArrayShape r = shapeOf(*rhs);
+        if (l.vector == r.vector) {
+            if (l.m != r.m || l.n != r.n)
+                throw ValueError(l.vector ? "NVectors must me the same size"
+                                          : "Matrices must be the same size");
+            // Divisors are checked now, so errors surface where they did
+            // before evaluation was deferred
+            ObPtr right = rhs;
+            if (op == ArithOp::Divide) {
+                right = forceLazy(right);
+                checkDivisor(*right);
+            }
+            return ObPtr(new LazyExpr(op, lazyOperand(lhs),
+                                      lazyOperand(right), 0));
+        }
+    }
+
+    // Undefined combinations: the operators report the error
+    return applyEager(op, *forceLazy(lhs), *forceLazy(rhs));
+}
+
+ObPtr arithmetic(ArithOp op, const ObPtr& lhs, const ObPtr& rhs) {
+    Number a, b;
+    unsigned l = readNumber(lhs, a);
+    unsigned r = readNumber(rhs, b);
+    if (l < 2 && r < 2) {
+        ObPtr res = integerOrFloat(op, l, r, a, b);
+        if (res)
+            return res;
+    }
+    return generalArithmetic(op, lhs, rhs, l, r, a, b);
+}
+
+// Folding left to right, as repeated arithmetic() would. While the running
+// result is an immediate number it is kept in a long long or double
+// instead of being encoded into a handle at every step.
+namespace {
+struct NativeNumber {
+    bool isFloat;
+    long long i;
+    double f;
+
+    bool load(const ObPtr& value) {
+        isFloat = value.isFloat();
+        if (isFloat)
+            f = value.floatValue();
+        else if (value.isInteger())
+            i = value.integerValue();
+        else
+            return false;
+        return true;
+    }
+
+    ObPtr box() const { return isFloat ? newFloat(f) : newInteger(i); }
+
+    // Applies op with an immediate rhs, the way the Integer and Float
+    // kernels do. Returns false, changing nothing, for whatever has to go
+    // through arithmetic(): other operands, overflow and zero divisors.
+    bool apply(ArithOp op, const ObPtr& rhs) {
+        if (!isFloat && rhs.isInteger()) {
+            long long r = rhs.integerValue();
+            long long res;
+            bool overflow = false;
+            switch (op) {
+                case ArithOp::Add:
+                    overflow = __builtin_add_overflow(i, r, &res);
+                    break;
+                case ArithOp::Subtract:
+                    overflow = __builtin_sub_overflow(i, r, &res);
+                    break;
+                case ArithOp::Multiply:
+                    overflow = __builtin_mul_overflow(i, r, &res);
+                    break;
+                case ArithOp::Divide:
+                    if (r == 0)
+                        return false;
+                    f = double(i) / r;
+                    isFloat = true;
+                    return true;
+            }
+            if (overflow)
+                return false;
+            i = res;
+            return true;
+        }
+        if (!rhs.isInteger() && !rhs.isFloat())
+            return false;
+        double l = isFloat ? f : i;
+        double r = rhs.isFloat() ? rhs.floatValue() : rhs.integerValue();
+        switch (op) {
+            case ArithOp::Add:      f = l + r; break;
+            case ArithOp::Subtract: f = l - r; break;
+            case ArithOp::Multiply: f = l * r; break;
+            case ArithOp::Divide:
+                if (rhs.isFloat() ? fabs(r) < EPSILON : rhs.integerValue() == 0)
+                    return false;
+                f = l / r;
+                break;
+        }
+        isFloat = true;
+        return true;
+    }
+};
+}
+
+ObPtr foldArithmetic(ArithOp op, Args args) {
+    NativeNumber acc;
+    bool native = acc.load(args[0]);
+    ObPtr res = args[0];
+    for (std::size_t k = 1; k < args.size(); k++) {
+        if (native && acc.apply(op, args[k]))
+            continue;
+        if (native)
+            res = acc.box();
+        res = arithmetic(op, res, args[k]);
+        native = acc.load(res);
+    }
+    return native ? acc.box() : res;
+}
+
+// Integer-Integer compares exactly, other pairs of immediate numbers as
+// doubles, like the Integer and Float operators
+static bool compareNumbers(CompareOp op, const ObPtr& lhs, const ObPtr& rhs) {
+    if (lhs.isInteger() && rhs.isInteger()) {
+        long long l = lhs.integerValue();
+        long long r = rhs.integerValue();
+        switch (op) {
+            case CompareOp::Equal:        return l == r;
+            case CompareOp::Less:         return l < r;
+            case CompareOp::LessEqual:    return l <= r;
+            case CompareOp::Greater:      return l > r;
+            case CompareOp::GreaterEqual: return l >= r;
+        }
+    }
+    double l = lhs.isFloat() ? lhs.floatValue() : lhs.integerValue();
+    double r = rhs.isFloat() ? rhs.floatValue() : rhs.integerValue();
+    switch (op) {
+        case CompareOp::Equal:        return fabs(l - r) <= EPSILON;
+        case CompareOp::Less:         return l < r;
+        case CompareOp::LessEqual:    return l <= r;
+        case CompareOp::Greater:      return !(l <= r);
+        case CompareOp::GreaterEqual: return !(l < r);
+    }
+    throw ValueError("Bad comparison");
+}
+
+static bool isNumber(const ObPtr& value) {
+    return value.isInteger() || value.isFloat();
+}
+
+ObPtr comparison(CompareOp op, const ObPtr& lhs, const ObPtr& rhs) {
+    if (isNumber(lhs) && isNumber(rhs))
+        return newBool(compareNumbers(op, lhs, rhs));
+    switch (op) {
+        case CompareOp::Equal:        return *lhs == *rhs;
+        case CompareOp::Less:         return *lhs < *rhs;
+        case CompareOp::LessEqual:    return *lhs <= *rhs;
+        case CompareOp::Greater:      return *lhs > *rhs;
+        case CompareOp::GreaterEqual: return *lhs >= *rhs;
+    }
+    throw ValueError("Bad comparison");
+}
+
+bool comparisonChain(CompareOp op, Args args) {
+    for (std::size_t k = 1; k < args.size(); k++) {
+        const ObPtr& lhs = args[k - 1];
+        const ObPtr& rhs = args[k];
+        bool holds = isNumber(lhs) && isNumber(rhs)
+            ? compareNumbers(op, lhs, rhs) : truthy(comparison(op, lhs, rhs));
+        if (!holds)
+            return false;
+    }
+    return true;
+}
+
+double asFlt(const ObPtr& value) {
+    if (value.isInteger())
+        return value.integerValue();
+    if (value.isFloat())
+        return value.floatValue();
+    return value->as<Numeric>()->asFlt();
+}
+
+long long asInteger(const ObPtr& value) {
+    if (value.isInteger())
+        return value.integerValue();
+    return value->as<Integer>()->value();
+}
+
+ObPtr forceLazy(const ObPtr& value) {
+    if (value.is<LazyExpr>())
+        return value->as<LazyExpr>()->force();
+    return value;
 }
 
 // Misc
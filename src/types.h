@@ -1,15 +1,24 @@
 #ifndef _TYPES_H_
 #define _TYPES_H_
 
+#include <algorithm>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
+#include "aligned.h"
+#include "bigint.h"
 #include "exceptions.h"
+#include "obptr.h"
+#include "pmap.h"
+#include "pvector.h"
 
 
 class Object;
@@ -18,49 +27,193 @@ class Numeric;
 class Integer;
 class Float;
 class Rational;
+class BigInteger;
 class Sequence;
 class List;
 class Vector;
 class HashMap;
 class Fn;
+class Closure;
+class CompiledFn;
 class Bool;
 class True;
 class False;
 class Nil;
 class Nvector;
 class Matrix;
+class LazyExpr;
+class LocalRef;
+class GlobalSym;
+class LetForm;
+class FnForm;
 
 class Env;
+struct Proto;
+struct Frame;
 
-typedef std::shared_ptr<Object> ObPtr;
-typedef std::vector<ObPtr>::iterator SequenceIter;
+typedef std::shared_ptr<Env> EnvPtr;
 typedef std::vector<ObPtr>::const_iterator SequenceConstIter;
-typedef std::function<ObPtr(std::vector<ObPtr>, const Env&)> Function;
 
-ObPtr newSymbol(std::string val);
+// Arguments of a native function: a view of values the caller owns and
+// keeps in place until the call returns
+class Args {
+    const ObPtr* data_;
+    std::size_t size_;
+public:
+    Args(const ObPtr* data, std::size_t size) : data_(data), size_(size) { };
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const ObPtr& operator[](std::size_t i) const { return data_[i]; }
+    const ObPtr* begin() const { return data_; }
+    const ObPtr* end() const { return data_ + size_; }
+};
+
+typedef ObPtr (*Function)(Args args, const Env& env);
+typedef std::vector<double, AlignedAllocator<double>> DoubleBuffer;
+typedef std::shared_ptr<DoubleBuffer> BufferPtr;
+
+ObPtr newSymbol(std::string_view val);
 ObPtr newInteger(long long val);
+// An Integer if val fits in a long long, a BigInteger otherwise
+ObPtr newInteger(const BigInt& val);
 ObPtr newFloat(double val);
-ObPtr newRational(int num, int den);
+ObPtr newRational(long long num, long long den);
+ObPtr newRational(const BigInt& num, const BigInt& den);
 ObPtr newList();
 ObPtr newList(SequenceConstIter begin, SequenceConstIter end);
+ObPtr newList(Args items);
 ObPtr newVector();
 ObPtr newVector(SequenceConstIter begin, SequenceConstIter end);
+ObPtr newVector(PersistentVector items);
 ObPtr newFn(Function ptr);
+ObPtr newClosure(ObPtr params, ObPtr body, EnvPtr env, ObPtr names = nullptr);
 ObPtr newBool(bool expr);
 ObPtr newTrue();
 ObPtr newFalse();
 ObPtr newNil();
 ObPtr newHashMap();
+ObPtr newHashMap(PersistentMap items);
 ObPtr newNvector();
+ObPtr newNvector(int size);
 ObPtr newMatrix();
+ObPtr newMatrix(int m, int n);
+
+enum class ArithOp { Add, Subtract, Multiply, Divide };
+
+// lhs op rhs. Elementwise Matrix and Nvector arithmetic is deferred into
+// a LazyExpr; everything else goes straight to the Object operators.
+ObPtr arithmetic(ArithOp op, const ObPtr& lhs, const ObPtr& rhs);
+// args[0] op args[1] op ... from the left; args must not be empty
+ObPtr foldArithmetic(ArithOp op, Args args);
+// The value itself, or the Matrix or Nvector a LazyExpr evaluates to
+ObPtr forceLazy(const ObPtr& value);
+
+enum class CompareOp { Equal, Less, LessEqual, Greater, GreaterEqual };
+
+// lhs op rhs, with immediate numbers compared without boxing
+ObPtr comparison(CompareOp op, const ObPtr& lhs, const ObPtr& rhs);
+// Whether op holds between every two neighbouring args. Stops at the
+// first pair it does not hold for.
+bool comparisonChain(CompareOp op, Args args);
+
+// Numeric values of a handle, immediate or boxed. Throw TypeError for
+// anything else.
+double asFlt(const ObPtr& value);
+long long asInteger(const ObPtr& value);
 
 std::string getInvalidOperandsTypeMsg(const Object& lhs, const Object& rhs);
 
 const static double EPSILON = std::numeric_limits<double>::epsilon();
 
+// Range of preallocated Integers that immediate integers dereference to
+const static long long SMALL_INT_MIN = -128;
+const static long long SMALL_INT_MAX = 1023;
+
+// Every concrete class has its own tag. Tags are ordered so that each
+// abstract class covers a contiguous range: is<T>() checks the range
+// [T::firstTag, T::lastTag] instead of calling dynamic_cast.
+enum class TypeTag : unsigned char {
+    Symbol,
+    Integer,
+    Float,
+    Rational,
+    BigInteger,
+    List,
+    Vector,
+    True,
+    False,
+    Nil,
+    Fn,
+    Closure,
+    CompiledFn,
+    HashMap,
+    Nvector,
+    Matrix,
+    LazyExpr,
+    LocalRef,
+    GlobalSym,
+    LetForm,
+    FnForm,
+};
+
+inline std::size_t hashCombine(std::size_t seed, std::size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
 
 class Object {
+    TypeTag tag_;
+    bool inArena_;
+    bool shared_;
+    mutable bool detached_;
+    mutable unsigned refs_;
+
+    void destroy() const;
+protected:
+    Object(TypeTag tag)
+        : tag_(tag), inArena_(false), shared_(false), detached_(false), refs_(0) { };
+    // A copy is a new object, with no references yet
+    Object(const Object& other)
+        : tag_(other.tag_), inArena_(false), shared_(false), detached_(false),
+          refs_(0) { };
+    Object& operator=(const Object&) { return *this; }
 public:
+    virtual ~Object() = default;
+
+    static constexpr TypeTag firstTag = TypeTag::Symbol;
+    static constexpr TypeTag lastTag = TypeTag::FnForm;
+    TypeTag tag() const { return tag_; }
+
+    // Set on nodes the reader allocates in an Arena (see arena.h)
+    bool inArena() const { return inArena_; }
+    void markInArena() { inArena_ = true; }
+    // Set on a collection once nothing it holds is known to reach an
+    // Arena (see reachesArena). Its contents never change, so it stays set.
+    bool detached() const { return detached_; }
+    void markDetached() const { detached_ = true; }
+
+    // Reference count kept for ObPtr. The interpreter runs on one thread,
+    // so counting is plain arithmetic; a value that other threads will
+    // copy handles to must be marked shared first, from then on its
+    // count is updated atomically.
+    void retain() const {
+        if (shared_)
+            __atomic_add_fetch(&refs_, 1, __ATOMIC_RELAXED);
+        else
+            refs_++;
+    }
+    void release() const {
+        if (shared_ ? __atomic_sub_fetch(&refs_, 1, __ATOMIC_ACQ_REL) == 0
+                    : --refs_ == 0)
+            destroy();
+    }
+    unsigned refCount() const {
+        return shared_ ? __atomic_load_n(&refs_, __ATOMIC_RELAXED) : refs_;
+    }
+    bool isShared() const { return shared_; }
+    void markShared() { shared_ = true; }
+
     template<typename T>
     T* as();
 
@@ -74,6 +227,10 @@ public:
     virtual std::string repr() const = 0;
     static std::string typeRpr() { return "<Object>"; };
 
+    // Structural hash, consistent with operator== for values that are
+    // used as HashMap keys (and therefore as Env keys).
+    virtual std::size_t hash() const = 0;
+
     virtual operator bool() const = 0;
     virtual ObPtr operator!() const { return newBool(!bool(*this)); };
 
@@ -92,51 +249,101 @@ public:
 
 template<typename T>
 T* Object::as() {
-    T* ptr = dynamic_cast<T*>(this);
-    if (!ptr)
+    if (!is<T>())
         throw TypeError(this->repr() + " is not a " + T::typeRpr() );
-    return ptr;
+    return static_cast<T*>(this);
 }
 
 template<typename T>
 const T* Object::as() const {
-    const T* ptr = dynamic_cast<const T*>(this);
-    if (!ptr)
+    if (!is<T>())
         throw TypeError(this->repr() + " is not a " + T::typeRpr() );
-    return ptr;
+    return static_cast<const T*>(this);
 }
 
 template<typename T>
 bool Object::is() const {
-    auto* ptr = dynamic_cast<const T*>(this);
-    return ptr;
+    constexpr unsigned first = unsigned(T::firstTag);
+    constexpr unsigned width = unsigned(T::lastTag) - first;
+    return unsigned(tag_) - first <= width;
+}
+
+
+inline void ObPtr::retain() const {
+    if (isObject())
+        object()->retain();
+}
+
+inline void ObPtr::release() const {
+    if (isObject())
+        object()->release();
+}
+
+inline long ObPtr::use_count() const {
+    return isObject() ? object()->refCount() : 0;
+}
+
+inline TypeTag ObPtr::tag() const {
+    if (isObject())
+        return object()->tag();
+    if (isInteger())
+        return TypeTag::Integer;
+    if (isFloat())
+        return TypeTag::Float;
+    if (isNil())
+        return TypeTag::Nil;
+    return isTrue() ? TypeTag::True : TypeTag::False;
+}
+
+template<typename T>
+bool ObPtr::is() const {
+    constexpr unsigned first = unsigned(T::firstTag);
+    constexpr unsigned width = unsigned(T::lastTag) - first;
+    return unsigned(tag()) - first <= width;
 }
 
 
 class Atom : public Object {
+protected:
+    Atom(TypeTag tag) : Object(tag) { };
 public:
+    static constexpr TypeTag firstTag = TypeTag::Symbol;
+    static constexpr TypeTag lastTag = TypeTag::BigInteger;
     virtual ~Atom() = 0;
     static std::string typeRpr() { return "<Atom>"; };
 };
 
+// Symbols are interned: newSymbol() returns the one Symbol object for a
+// given name, so two symbols are equal iff they are the same object.
 class Symbol : public Atom {
     std::string name_;
+    unsigned id_;
+    Symbol(std::string_view str, unsigned id)
+        : Atom(TypeTag::Symbol), name_(str), id_(id) { };
+    friend ObPtr newSymbol(std::string_view val);
 public:
-    Symbol(const std::string& str) : name_(str) { };
-
+    static constexpr TypeTag firstTag = TypeTag::Symbol;
+    static constexpr TypeTag lastTag = TypeTag::Symbol;
     std::string typeRepr() const { return "<Symbol>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<Symbol>"; };
+    std::size_t hash() const { return id_; }
 
     operator bool() const { return !name_.empty(); }
 
     ObPtr operator==(const Object& rhs) const;
     bool matches(const std::string& val) { return name_ == val; }
+    unsigned id() const { return id_; }
+    const std::string& name() const { return name_; }
 };
 
 
 class Numeric : public Atom {
+protected:
+    Numeric(TypeTag tag) : Atom(tag) { };
 public:
+    static constexpr TypeTag firstTag = TypeTag::Integer;
+    static constexpr TypeTag lastTag = TypeTag::BigInteger;
     virtual ~Numeric() = 0;
     static std::string typeRpr() { return "<Numeric>"; };
     virtual double asFlt() const = 0;
@@ -146,11 +353,14 @@ public:
 class Integer : public Numeric {
     long long int_;
 public:
-    Integer(long long val) : int_(val) { };
+    Integer(long long val) : Numeric(TypeTag::Integer), int_(val) { };
+    static constexpr TypeTag firstTag = TypeTag::Integer;
+    static constexpr TypeTag lastTag = TypeTag::Integer;
 
     std::string typeRepr() const { return "<Integer>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<Integer>"; };
+    std::size_t hash() const { return std::hash<long long> {}(int_); }
 
     long long value() const { return int_; }
     virtual double asFlt() const { return int_; };
@@ -172,11 +382,14 @@ public:
 class Float : public Numeric {
     double float_;
 public:
-    Float(double val) : float_(val) { };
+    Float(double val) : Numeric(TypeTag::Float), float_(val) { };
+    static constexpr TypeTag firstTag = TypeTag::Float;
+    static constexpr TypeTag lastTag = TypeTag::Float;
 
     std::string typeRepr() const { return "<Float>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<Float>"; };
+    std::size_t hash() const;
 
     double value() const { return float_; }
     virtual double asFlt() const { return float_; };
@@ -195,23 +408,47 @@ public:
     ObPtr operator>=(const Object& rhs) const;
 };
 
+// A fraction in lowest terms with a positive denominator. When either
+// part does not fit in a long long both are kept as BigInts in big_, and
+// numer_ and denom_ are unused.
 class Rational : public Numeric {
+    struct BigParts {
+        BigInt numer;
+        BigInt denom;
+    };
+
     long long numer_;
     long long denom_;
+    std::shared_ptr<const BigParts> big_;
     void simplify_();
+    void store_(const BigInt& num, const BigInt& den);
 public:
-    Rational(int num, int den);
+    // Marks num and den as already in lowest terms, den positive
+    struct Reduced { };
+
+    Rational(long long num, long long den);
+    Rational(long long num, long long den, Reduced)
+        : Numeric(TypeTag::Rational), numer_(num), denom_(den) { };
+    Rational(const BigInt& num, const BigInt& den);
+    Rational(const BigInt& num, const BigInt& den, Reduced);
+    static constexpr TypeTag firstTag = TypeTag::Rational;
+    static constexpr TypeTag lastTag = TypeTag::Rational;
 
     std::string typeRepr() const { return "<Rational>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<Rational>"; };
+    std::size_t hash() const;
 
+    bool isBig() const { return big_ != nullptr; }
+    // Only for a Rational that is not big
     long long numer() const { return numer_; }
     long long denom() const { return denom_; }
-    double value() const { return double(numer_) / denom_; }
-    virtual double asFlt() const { return double(numer_) / denom_; };
+    BigInt bigNumer() const { return big_ ? big_->numer : BigInt(numer_); }
+    BigInt bigDenom() const { return big_ ? big_->denom : BigInt(denom_); }
+    double value() const;
+    virtual double asFlt() const { return value(); };
 
-    operator bool() const { return numer_ > 0; }
+    operator bool() const;
 
     ObPtr operator==(const Object& rhs) const;
     ObPtr operator+(const Object& rhs) const;
@@ -225,82 +462,285 @@ public:
     ObPtr operator>=(const Object& rhs) const;
 };
 
+// An integer outside the range of long long. Integer arithmetic that
+// overflows gives a BigInteger, and newInteger() turns results that fit
+// back into Integers, so each value has one representation.
+class BigInteger : public Numeric {
+    BigInt int_;
+public:
+    BigInteger(BigInt val) : Numeric(TypeTag::BigInteger), int_(std::move(val)) { };
+    static constexpr TypeTag firstTag = TypeTag::BigInteger;
+    static constexpr TypeTag lastTag = TypeTag::BigInteger;
+
+    std::string typeRepr() const { return "<Integer>"; }
+    std::string repr() const { return int_.toString(); }
+    static std::string typeRpr() { return "<Integer>"; };
+    std::size_t hash() const;
+
+    const BigInt& value() const { return int_; }
+    virtual double asFlt() const { return int_.toDouble(); };
+
+    // Never zero
+    operator bool() const { return true; }
+
+    ObPtr operator==(const Object& rhs) const;
+    ObPtr operator+(const Object& rhs) const;
+    ObPtr operator-(const Object& rhs) const;
+    ObPtr operator*(const Object& rhs) const;
+    ObPtr operator/(const Object& rhs) const;
+
+    ObPtr operator<(const Object& rhs) const;
+    ObPtr operator<=(const Object& rhs) const;
+    ObPtr operator>(const Object& rhs) const;
+    ObPtr operator>=(const Object& rhs) const;
+};
 
 class Sequence : public Object {
 protected:
-    std::vector<ObPtr> vector_;
+    // Sequences are only mutated while being built (reader, evalAst),
+    // so the hash is computed once and dropped on push.
+    mutable std::size_t hash_ = 0;
+    mutable bool hashed_ = false;
+    Sequence(TypeTag tag) : Object(tag) {};
 public:
-    Sequence() {};
-    Sequence(SequenceConstIter begin, SequenceConstIter end)
-        : vector_(begin, end) { }
+    class Iterator;
+
+    static constexpr TypeTag firstTag = TypeTag::List;
+    static constexpr TypeTag lastTag = TypeTag::Vector;
     virtual ~Sequence() = 0;
     static std::string typeRpr() { return "<Sequence>"; };
+    std::size_t hash() const;
 
-    operator bool() const { return !vector_.empty(); }
+    operator bool() const { return !empty(); }
 
-    SequenceIter begin() { return vector_.begin(); };
-    SequenceIter end() { return vector_.end(); };
-    SequenceConstIter begin() const { return vector_.cbegin(); };
-    SequenceConstIter end() const { return vector_.cend(); };
+    inline Iterator begin() const;
+    inline Iterator end() const;
 
     ObPtr operator==(const Object& rhs) const;
 
-    bool empty() const { return vector_.empty(); };
-    int size() const { return vector_.size(); };
-    ObPtr at(unsigned idx) const { return vector_.at(idx); };
+    inline bool empty() const;
+    inline int size() const;
+    // Throws std::out_of_range past the end
+    inline const ObPtr& at(unsigned idx) const;
 };
 
 
 class List : public Sequence {
+    std::vector<ObPtr> items_;
 public:
-    List() { };
+    List() : Sequence(TypeTag::List) { };
     List(SequenceConstIter begin, SequenceConstIter end)
-        : Sequence(begin, end) { }
+        : Sequence(TypeTag::List), items_(begin, end) { }
+    static constexpr TypeTag firstTag = TypeTag::List;
+    static constexpr TypeTag lastTag = TypeTag::List;
 
     std::string typeRepr() const { return "<List>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<List>"; };
 
+    SequenceConstIter begin() const { return items_.cbegin(); };
+    SequenceConstIter end() const { return items_.cend(); };
+    const ObPtr* data() const { return items_.data(); };
+
+    bool empty() const { return items_.empty(); };
+    int size() const { return items_.size(); };
+    const ObPtr& at(unsigned idx) const { return items_.at(idx); };
+
     void push(ObPtr valuePtr);
 };
 
 
+// Elements are held in a PersistentVector, so copies made by assoc and
+// conj share all but the path they change with the original.
 class Vector : public Sequence {
+    PersistentVector items_;
 public:
-    Vector() { };
-    Vector(SequenceConstIter begin, SequenceConstIter end)
-        : Sequence(begin, end) { }
+    Vector() : Sequence(TypeTag::Vector) { };
+    Vector(SequenceConstIter begin, SequenceConstIter end);
+    explicit Vector(PersistentVector items)
+        : Sequence(TypeTag::Vector), items_(std::move(items)) { }
+    static constexpr TypeTag firstTag = TypeTag::Vector;
+    static constexpr TypeTag lastTag = TypeTag::Vector;
 
     std::string typeRepr() const { return "<Vector>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<Vector>"; };
 
-    void push(ObPtr valuePtr);
+    const PersistentVector& items() const { return items_; }
+
+    bool empty() const { return items_.empty(); };
+    int size() const { return items_.size(); };
+    const ObPtr& at(unsigned idx) const {
+        if (idx >= items_.size())
+            throw std::out_of_range("Vector::at");
+        return items_[idx];
+    };
 };
 
 
+// Walks a List's items directly and a Vector's a leaf at a time
+class Sequence::Iterator {
+    // Null for a List, whose items are a single run
+    const PersistentVector* vector_;
+    const ObPtr* cur_;
+    const ObPtr* runEnd_;
+    std::size_t index_;
+
+    void nextRun() {
+        if (index_ < vector_->size()) {
+            cur_ = vector_->leafFor(index_);
+            runEnd_ = cur_ + std::min(PersistentVector::WIDTH, vector_->size() - index_);
+        }
+    }
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ObPtr value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const ObPtr* pointer;
+    typedef const ObPtr& reference;
+
+    Iterator(const ObPtr* items, std::size_t size, std::size_t index)
+        : vector_(nullptr), cur_(items + index), runEnd_(items + size), index_(index) { }
+    Iterator(const PersistentVector& vector, std::size_t index)
+        : vector_(&vector), cur_(nullptr), runEnd_(nullptr), index_(index) {
+        nextRun();
+    }
+
+    const ObPtr& operator*() const { return *cur_; }
+    const ObPtr* operator->() const { return cur_; }
+    Iterator& operator++() {
+        index_++;
+        if (++cur_ == runEnd_ && vector_)
+            nextRun();
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator prev = *this;
+        ++*this;
+        return prev;
+    }
+    bool operator==(const Iterator& rhs) const { return index_ == rhs.index_; }
+    bool operator!=(const Iterator& rhs) const { return index_ != rhs.index_; }
+};
+
+Sequence::Iterator Sequence::begin() const {
+    if (tag() == TypeTag::List) {
+        const List* list = static_cast<const List*>(this);
+        return Iterator(list->data(), list->size(), 0);
+    }
+    return Iterator(static_cast<const Vector*>(this)->items(), 0);
+}
+
+Sequence::Iterator Sequence::end() const {
+    if (tag() == TypeTag::List) {
+        const List* list = static_cast<const List*>(this);
+        return Iterator(list->data(), list->size(), list->size());
+    }
+    const PersistentVector& items = static_cast<const Vector*>(this)->items();
+    return Iterator(items, items.size());
+}
+
+bool Sequence::empty() const {
+    if (tag() == TypeTag::List)
+        return static_cast<const List*>(this)->empty();
+    return static_cast<const Vector*>(this)->empty();
+}
+
+int Sequence::size() const {
+    if (tag() == TypeTag::List)
+        return static_cast<const List*>(this)->size();
+    return static_cast<const Vector*>(this)->size();
+}
+
+const ObPtr& Sequence::at(unsigned idx) const {
+    if (tag() == TypeTag::List)
+        return static_cast<const List*>(this)->at(idx);
+    return static_cast<const Vector*>(this)->at(idx);
+}
+
+
 class Fn : public Object {
     Function ptr_;
 public:
-    Fn(Function ptr) : ptr_(ptr) { };
+    Fn(Function ptr) : Object(TypeTag::Fn), ptr_(ptr) { };
+    static constexpr TypeTag firstTag = TypeTag::Fn;
+    static constexpr TypeTag lastTag = TypeTag::Fn;
 
     std::string typeRepr() const { return "<Function>"; }
     std::string repr() const { return std::string("#<Function>"); }
     static std::string typeRpr() { return "<Function>"; };
+    std::size_t hash() const { return std::hash<const void*> {}(this); }
 
-    operator bool() const { return bool(ptr_); }
+    operator bool() const { return ptr_ != nullptr; }
 
-    ObPtr operator()(std::vector<ObPtr> args, const Env& env) {
+    ObPtr operator()(Args args, const Env& env) const {
         return ptr_(args, env);
     }
 };
 
 
+// Function created by fn*. It is plain data rather than a native
+// Function so that EVAL can apply it in place without recursing.
+class Closure : public Object {
+    ObPtr params_;
+    ObPtr body_;
+    EnvPtr env_;
+    ObPtr names_;
+public:
+    Closure(ObPtr params, ObPtr body, EnvPtr env, ObPtr names)
+        : Object(TypeTag::Closure), params_(params), body_(body), env_(env),
+          names_(names) { };
+    static constexpr TypeTag firstTag = TypeTag::Closure;
+    static constexpr TypeTag lastTag = TypeTag::Closure;
+
+    std::string typeRepr() const { return "<Function>"; }
+    std::string repr() const { return std::string("#<Function>"); }
+    static std::string typeRpr() { return "<Closure>"; };
+    std::size_t hash() const { return std::hash<const void*> {}(this); }
+
+    operator bool() const { return true; }
+
+    const ObPtr& params() const { return params_; }
+    const ObPtr& body() const { return body_; }
+    const EnvPtr& env() const { return env_; }
+    // Locals of a resolved fn* (see FnForm), null if it was not resolved
+    const ObPtr& names() const { return names_; }
+};
+
+
+// Function created by fn* under the bytecode VM: compiled code plus the
+// frame it was created in.
+class CompiledFn : public Object {
+    std::shared_ptr<Proto> proto_;
+    std::shared_ptr<Frame> frame_;
+public:
+    CompiledFn(std::shared_ptr<Proto> proto, std::shared_ptr<Frame> frame)
+        : Object(TypeTag::CompiledFn), proto_(proto), frame_(frame) { };
+    static constexpr TypeTag firstTag = TypeTag::CompiledFn;
+    static constexpr TypeTag lastTag = TypeTag::CompiledFn;
+
+    std::string typeRepr() const { return "<Function>"; }
+    std::string repr() const { return std::string("#<Function>"); }
+    static std::string typeRpr() { return "<CompiledFn>"; };
+    std::size_t hash() const { return std::hash<const void*> {}(this); }
+
+    operator bool() const { return true; }
+
+    const std::shared_ptr<Proto>& proto() const { return proto_; }
+    const std::shared_ptr<Frame>& frame() const { return frame_; }
+};
+
+
 class Bool : public Object {
+protected:
+    Bool(TypeTag tag) : Object(tag) { };
 public:
+    static constexpr TypeTag firstTag = TypeTag::True;
+    static constexpr TypeTag lastTag = TypeTag::False;
     virtual ~Bool() = 0;
     std::string typeRepr() const { return "<Bool>"; }
     static std::string typeRpr() { return "<Bool>"; };
+    std::size_t hash() const { return bool(*this) ? 1231 : 1237; }
 
     ObPtr operator==(const Object& rhs) const;
     virtual operator bool() const = 0;
@@ -309,6 +749,9 @@ public:
 
 class True : public Bool {
 public:
+    True() : Bool(TypeTag::True) { };
+    static constexpr TypeTag firstTag = TypeTag::True;
+    static constexpr TypeTag lastTag = TypeTag::True;
     std::string repr() const { return "true"; }
     operator bool() const { return true; }
 };
@@ -316,6 +759,9 @@ public:
 
 class False : public Bool {
 public:
+    False() : Bool(TypeTag::False) { };
+    static constexpr TypeTag firstTag = TypeTag::False;
+    static constexpr TypeTag lastTag = TypeTag::False;
     std::string repr() const { return "false"; }
     operator bool() const { return false; }
 };
@@ -323,9 +769,13 @@ public:
 
 class Nil : public Object {
 public:
+    Nil() : Object(TypeTag::Nil) { };
+    static constexpr TypeTag firstTag = TypeTag::Nil;
+    static constexpr TypeTag lastTag = TypeTag::Nil;
     std::string typeRepr() const { return "<Nil>"; }
     std::string repr() const { return "nil"; }
     static std::string typeRpr() { return "<Nil>"; };
+    std::size_t hash() const { return 0; }
 
     ObPtr operator==(const Object& rhs) const;
     operator bool() const { return false; }
@@ -333,47 +783,71 @@ public:
 
 
 struct ValueHash {
-    std::size_t operator()(ObPtr val) const {
-        return std::hash<std::string> {}(val->repr());
+    std::size_t operator()(const ObPtr& val) const {
+        return val->hash();
     }
 };
 
 struct HashMapPred {
-    ObPtr operator()(ObPtr lhs, ObPtr rhs) const {
-        return (*lhs) == (*rhs) ? ObPtr(new True) : ObPtr(new False);
+    bool operator()(const ObPtr& lhs, const ObPtr& rhs) const {
+        return lhs == rhs || bool(*((*lhs) == (*rhs)));
     }
 };
 
+// Entries are held in a PersistentMap, so copies made by assoc and
+// dissoc share all but the path they change with the original.
 class HashMap : public Object {
-    std::unordered_map<ObPtr, ObPtr, ValueHash, HashMapPred> map_;
+    PersistentMap items_;
+    mutable std::size_t hash_ = 0;
+    mutable bool hashed_ = false;
 public:
+    HashMap() : Object(TypeTag::HashMap) { };
+    explicit HashMap(PersistentMap items)
+        : Object(TypeTag::HashMap), items_(std::move(items)) { };
+    static constexpr TypeTag firstTag = TypeTag::HashMap;
+    static constexpr TypeTag lastTag = TypeTag::HashMap;
     std::string typeRepr() const { return "<HashMap>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<HashMap>"; };
+    std::size_t hash() const;
+
+    const PersistentMap& items() const { return items_; }
 
+    // Only while the map is being built
     void set(ObPtr key, ObPtr val);
-    ObPtr get(ObPtr key);
-    ObPtr get(ObPtr key) const;
-    bool has(const ObPtr& val) const { return map_.find(val) != map_.end(); }
+    ObPtr get(const ObPtr& key) const;
+    const ObPtr* find(const ObPtr& key) const { return items_.find(key); }
+    bool has(const ObPtr& key) const { return items_.find(key) != nullptr; }
+    std::size_t size() const { return items_.size(); }
 
-    operator bool() const { return !map_.empty(); }
+    operator bool() const { return !items_.empty(); }
 
     ObPtr operator==(const Object& rhs) const;
 
-    auto begin() { return map_.begin(); };
-    auto end() { return map_.end(); };
-    auto cbegin() const { return map_.cbegin(); };
-    auto cend() const { return map_.cend(); };
+    PersistentMap::Iterator begin() const { return items_.begin(); };
+    PersistentMap::Iterator end() const { return items_.end(); };
 };
 
+// Nvector and Matrix objects can share one buffer: LazyExpr leaves do,
+// so that writing in place can tell the old values are still needed.
 class Nvector : public Object {
-    std::vector<double> data_;
+    BufferPtr data_;
 public:
+    Nvector()
+        : Object(TypeTag::Nvector), data_(std::make_shared<DoubleBuffer>()) { };
+    explicit Nvector(int size)
+        : Object(TypeTag::Nvector),
+          data_(std::make_shared<DoubleBuffer>(size, 0.0)) { };
+    explicit Nvector(BufferPtr data)
+        : Object(TypeTag::Nvector), data_(std::move(data)) { };
+    static constexpr TypeTag firstTag = TypeTag::Nvector;
+    static constexpr TypeTag lastTag = TypeTag::Nvector;
     std::string typeRepr() const { return "<Nvector>"; }
     std::string repr() const;
     static std::string typeRpr() { return "<Nvector>"; };
+    std::size_t hash() const;
 
-    operator bool() const { return !data_.empty(); }
+    operator bool() const { return !data_->empty(); }
 
     ObPtr operator==(const Object& rhs) const;
 
@@ -382,30 +856,50 @@ public:
     ObPtr operator*(const Object& rhs) const;
     ObPtr operator/(const Object& rhs) const;
 
-    double& operator[](unsigned idx) { return data_[idx]; };
-    double operator[](unsigned idx) const { return data_.at(idx); };
-
-    int size() const { return data_.size(); }
-    double at(unsigned idx) const { return data_.at(idx); }
-    void push(double val) { data_.push_back(val); }
-    void clear() { data_.clear(); }
+    double& operator[](unsigned idx) { return (*data_)[idx]; };
+    double operator[](unsigned idx) const { return data_->at(idx); };
+
+    int size() const { return data_->size(); }
+    double* data() { return data_->data(); }
+    const double* data() const { return data_->data(); }
+    double at(unsigned idx) const { return data_->at(idx); }
+    void push(double val) { data_->push_back(val); }
+    void clear() { data_->clear(); }
+
+    // A new Nvector over the same buffer
+    ObPtr share() const { return ObPtr(new Nvector(data_)); }
+    bool uniqueBuffer() const { return data_.use_count() == 1; }
+    // Copies the buffer if it is shared, before writing in place
+    void makeUnique();
 };
 
 
+// Dense m x n matrix in one contiguous buffer. Rows start `stride`
+// doubles apart, with stride rounded up so that every row is aligned for
+// SIMD loads; the padding is zero.
 class Matrix : public Object
 {
-    std::vector<Nvector> data_;
-    Matrix(const Matrix& other);
-    Matrix(Matrix&& other);
-    Matrix(int m, int n);
+    int m_;
+    int n_;
+    int stride_;
+    BufferPtr data_;
 public:
-    Matrix() { };
+    Matrix()
+        : Object(TypeTag::Matrix), m_(0), n_(0), stride_(0),
+          data_(std::make_shared<DoubleBuffer>()) { };
+    Matrix(int m, int n);
+    Matrix(int m, int n, int stride, BufferPtr data)
+        : Object(TypeTag::Matrix), m_(m), n_(n), stride_(stride),
+          data_(std::move(data)) { };
+    static constexpr TypeTag firstTag = TypeTag::Matrix;
+    static constexpr TypeTag lastTag = TypeTag::Matrix;
 
     std::string typeRepr() const;
     std::string repr() const;
     static std::string typeRpr() { return "<Matrix>"; };
+    std::size_t hash() const;
 
-    operator bool() const { return !data_.empty(); }
+    operator bool() const { return m_ > 0 && n_ > 0; }
 
     ObPtr operator==(const Object& rhs) const;
     // ObPtr operator<(const Object& rhs) const;
@@ -418,17 +912,194 @@ public:
     ObPtr operator*(const Object& rhs) const;
     ObPtr operator/(const Object& rhs) const;
 
-    inline int m() const { return data_.size(); };
-    inline int n() const { return data_.empty() ? 0 : data_[0].size(); };
+    inline int m() const { return m_; };
+    inline int n() const { return n_; };
+    inline int stride() const { return stride_; };
+
+    double* data() { return data_->data(); }
+    const double* data() const { return data_->data(); }
 
-    Nvector& operator[](unsigned idx) { return data_[idx]; };
-    const Nvector operator[](unsigned idx) const { return data_.at(idx); }
+    // Row views into the buffer
+    double* operator[](unsigned idx) { return data_->data() + idx * stride_; };
+    const double* operator[](unsigned idx) const {
+        return data_->data() + idx * stride_;
+    }
 
-    void push(Nvector newRow) { data_.push_back(newRow); }
-    void addEmptyRow() { data_.push_back({ }); }
+    // A new Matrix over the same buffer
+    ObPtr share() const { return ObPtr(new Matrix(m_, n_, stride_, data_)); }
+    bool uniqueBuffer() const { return data_.use_count() == 1; }
+    // Copies the buffer if it is shared, before writing in place
+    void makeUnique();
 
     ObPtr dot(const Matrix& rhs) const;
     // double trace();
 };
 
+
+// Deferred elementwise Matrix or Nvector arithmetic, built by
+// arithmetic(). Operands are Matrix or Nvector leaves, other LazyExprs,
+// or a scalar on the right. force() evaluates the whole tree in one pass
+// over memory, a block of a row at a time, and keeps the result in place
+// of the tree; printing, comparing and hashing force implicitly.
+class LazyExpr : public Object {
+    ArithOp op_;
+    mutable ObPtr lhs_;
+    mutable ObPtr rhs_;     // null when the right operand is scalar_
+    double scalar_;
+    int m_;
+    int n_;
+    bool vector_;           // evaluates to an Nvector rather than a Matrix
+    int scratch_;           // row blocks needed to evaluate right subtrees
+    mutable ObPtr forced_;
+
+    void evaluate(int i, int j0, int len, double* out, double* scratch) const;
+    ObPtr reusableLeaf() const;
+    static const double* segment(const Object& operand, int i, int j0,
+                                 int len, double* out, double* scratch);
+public:
+    LazyExpr(ArithOp op, ObPtr lhs, ObPtr rhs, double scalar);
+    static constexpr TypeTag firstTag = TypeTag::LazyExpr;
+    static constexpr TypeTag lastTag = TypeTag::LazyExpr;
+
+    std::string typeRepr() const;
+    std::string repr() const { return force()->repr(); }
+    static std::string typeRpr() { return "<LazyExpr>"; };
+    std::size_t hash() const { return force()->hash(); }
+
+    operator bool() const { return bool(*force()); }
+
+    ObPtr operator==(const Object& rhs) const;
+    ObPtr operator+(const Object& rhs) const { return *force() + rhs; }
+    ObPtr operator-(const Object& rhs) const { return *force() - rhs; }
+    ObPtr operator*(const Object& rhs) const { return *force() * rhs; }
+    ObPtr operator/(const Object& rhs) const { return *force() / rhs; }
+
+    int m() const { return m_; }
+    int n() const { return n_; }
+    bool isVector() const { return vector_; }
+    int scratch() const { return scratch_; }
+    bool isForced() const { return bool(forced_); }
+    const ObPtr& force() const;
+};
+
+// Nodes resolve() puts in place of symbols, and of the let* and fn*
+// forms that introduce local variables, before the tree-walker evaluates
+// a form. Locals live in slots of flat frames (see Env), named by a
+// Vector of symbols; globals keep hash lookups. Each node prints as the
+// source it replaces.
+
+// Local variable: slot `slot` of the frame `depth` levels out
+class LocalRef : public Object {
+    ObPtr symbol_;
+    int depth_;
+    int slot_;
+public:
+    LocalRef(ObPtr symbol, int depth, int slot)
+        : Object(TypeTag::LocalRef), symbol_(symbol), depth_(depth),
+          slot_(slot) { };
+    static constexpr TypeTag firstTag = TypeTag::LocalRef;
+    static constexpr TypeTag lastTag = TypeTag::LocalRef;
+
+    std::string typeRepr() const { return "<Symbol>"; }
+    std::string repr() const { return symbol_->repr(); }
+    static std::string typeRpr() { return "<LocalRef>"; };
+    std::size_t hash() const { return symbol_->hash(); }
+
+    operator bool() const { return true; }
+
+    const ObPtr& symbol() const { return symbol_; }
+    int depth() const { return depth_; }
+    int slot() const { return slot_; }
+};
+
+// Symbol bound outside every enclosing let* and fn*. The binding found
+// is cached until an Env changes (see Env::version()).
+class GlobalSym : public Object {
+    ObPtr symbol_;
+    mutable const ObPtr* value_;
+    mutable unsigned version_;
+public:
+    GlobalSym(ObPtr symbol)
+        : Object(TypeTag::GlobalSym), symbol_(symbol), value_(nullptr),
+          version_(0) { };
+    static constexpr TypeTag firstTag = TypeTag::GlobalSym;
+    static constexpr TypeTag lastTag = TypeTag::GlobalSym;
+
+    std::string typeRepr() const { return "<Symbol>"; }
+    std::string repr() const { return symbol_->repr(); }
+    static std::string typeRpr() { return "<GlobalSym>"; };
+    std::size_t hash() const { return symbol_->hash(); }
+
+    operator bool() const { return true; }
+
+    const ObPtr& symbol() const { return symbol_; }
+    const ObPtr& lookup(const Env& env) const;
+};
+
+// let* whose names are all symbols: inits()[i] is evaluated in the new
+// frame and stored in slot slots()[i]
+class LetForm : public Object {
+    ObPtr source_;
+    ObPtr names_;
+    std::vector<int> slots_;
+    std::vector<ObPtr> inits_;
+    ObPtr body_;
+public:
+    LetForm(ObPtr source, ObPtr names, std::vector<int> slots,
+            std::vector<ObPtr> inits, ObPtr body)
+        : Object(TypeTag::LetForm), source_(source), names_(names),
+          slots_(std::move(slots)), inits_(std::move(inits)), body_(body) { };
+    static constexpr TypeTag firstTag = TypeTag::LetForm;
+    static constexpr TypeTag lastTag = TypeTag::LetForm;
+
+    std::string typeRepr() const { return "<List>"; }
+    std::string repr() const { return source_->repr(); }
+    static std::string typeRpr() { return "<LetForm>"; };
+    std::size_t hash() const { return source_->hash(); }
+
+    operator bool() const { return true; }
+
+    const ObPtr& names() const { return names_; }
+    const std::vector<int>& slots() const { return slots_; }
+    const std::vector<ObPtr>& inits() const { return inits_; }
+    const ObPtr& body() const { return body_; }
+};
+
+// fn* whose parameters are all symbols; they take the first slots
+class FnForm : public Object {
+    ObPtr source_;
+    ObPtr params_;
+    ObPtr names_;
+    ObPtr body_;
+public:
+    FnForm(ObPtr source, ObPtr params, ObPtr names, ObPtr body)
+        : Object(TypeTag::FnForm), source_(source), params_(params),
+          names_(names), body_(body) { };
+    static constexpr TypeTag firstTag = TypeTag::FnForm;
+    static constexpr TypeTag lastTag = TypeTag::FnForm;
+
+    std::string typeRepr() const { return "<List>"; }
+    std::string repr() const { return source_->repr(); }
+    static std::string typeRpr() { return "<FnForm>"; };
+    std::size_t hash() const { return source_->hash(); }
+
+    operator bool() const { return true; }
+
+    const ObPtr& params() const { return params_; }
+    const ObPtr& names() const { return names_; }
+    const ObPtr& body() const { return body_; }
+};
+
+
+// Truth value of a handle, without boxing immediates
+inline bool truthy(const ObPtr& value) {
+    if (value.isInteger())
+        return value.integerValue() != 0;
+    if (value.isFloat())
+        return value.floatValue() < EPSILON;  // as Float::operator bool
+    if (value.isNil() || value.isFalse())
+        return false;
+    return value.isTrue() || bool(*value);
+}
+
 #endif
@@ -1,4 +1,5 @@
 #include <sstream>
+#include <algorithm>
 
 #include "utils.h"
 
@@ -18,6 +19,21 @@ unsigned maxWidthInCol(const Matrix& matrix, int j) {
     return maxWidth;
 }
 
-long long gcd(long long a, long long b) {
-    return b == 0 ? a : gcd(b, a % b);
+// Stein's binary algorithm: shifts and subtractions instead of the
+// divisions of Euclid's, which are the slow part on small numbers
+unsigned long long gcd(unsigned long long a, unsigned long long b) {
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+    int shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    do {
+        b >>= __builtin_ctzll(b);
+        // min and max rather than a swap, which compile without branches
+        unsigned long long lo = std::min(a, b);
+        b = std::max(a, b) - lo;
+        a = lo;
+    } while (b != 0);
+    return a << shift;
 }
@@ -5,7 +5,8 @@
 
 unsigned numberOfDigits(double n);
 unsigned maxWidthInCol(const Matrix& matrix, int j);
-long long gcd(long long a, long long b);
+// Non-negative; gcd(0, 0) is 0
+unsigned long long gcd(unsigned long long a, unsigned long long b);
 
 
 #endif
@@ -0,0 +1,201 @@
+#include <string>
+
+#include "arena.h"
+#include "exceptions.h"
+#include "vm.h"
+
+
+void Frame::references(std::vector<const ObPtr*>& values,
+                       std::vector<const Collectable*>& frames) const {
+    for (const ObPtr& value : slots)
+        values.push_back(&value);
+    frames.push_back(parent.get());
+}
+
+void Frame::dropReferences() {
+    slots.clear();
+    parent.reset();
+}
+
+VM::VM(EnvPtr globals) : globals_(globals), version_(1) {
+    for (unsigned op = 0; op < unsigned(Intrinsic::Count); op++)
+        intrinsics_[op] = globals_->get(newSymbol(INTRINSIC_NAMES[op]));
+}
+
+ObPtr VM::run(ObPtr ast) {
+    ProtoPtr proto = compile(ast);
+    stack_.clear();
+    calls_.clear();
+    return execute(proto);
+}
+
+const ObPtr& VM::global(GlobalRef& ref) {
+    if (ref.version != version_) {
+        ref.value = globals_->lookup(ref.symbol);
+        ref.version = version_;
+    }
+    return *ref.value;
+}
+
+static ObPtr applyIntrinsic(Intrinsic op, const ObPtr& lhs, const ObPtr& rhs) {
+    switch (op) {
+        case Intrinsic::Add:          return arithmetic(ArithOp::Add, lhs, rhs);
+        case Intrinsic::Subtract:     return arithmetic(ArithOp::Subtract, lhs, rhs);
+        case Intrinsic::Multiply:     return arithmetic(ArithOp::Multiply, lhs, rhs);
+        case Intrinsic::Divide:       return arithmetic(ArithOp::Divide, lhs, rhs);
+        case Intrinsic::Equal:        return comparison(CompareOp::Equal, lhs, rhs);
+        case Intrinsic::Less:         return comparison(CompareOp::Less, lhs, rhs);
+        case Intrinsic::LessEqual:    return comparison(CompareOp::LessEqual, lhs, rhs);
+        case Intrinsic::Greater:      return comparison(CompareOp::Greater, lhs, rhs);
+        case Intrinsic::GreaterEqual: return comparison(CompareOp::GreaterEqual, lhs, rhs);
+        default:                      throw ValueError("Bad intrinsic");
+    }
+}
+
+// Calls the callee found below the top argc values of the stack. Native
+// functions run immediately; a CompiledFn gets a new call record, or
+// takes over the current one for a tail call.
+void VM::invoke(std::size_t argc, bool tail) {
+    std::size_t at = stack_.size() - argc - 1;
+    Object* callee = stack_[at].get();
+    if (callee->is<CompiledFn>()) {
+        CompiledFn* fn = callee->as<CompiledFn>();
+        Proto* proto = fn->proto().get();
+        if (int(argc) != proto->arity)
+            throw TypeError(fn->repr() + " takes " +
+                    std::to_string(proto->arity) + " args, but " +
+                    std::to_string(argc) + " were given");
+        FramePtr frame(new Frame(fn->frame(), proto->slots));
+        for (std::size_t i = 0; i < argc; i++)
+            frame->slots[i] = std::move(stack_[at + 1 + i]);
+        stack_.resize(at + 1);
+
+        CallInfo& current = calls_.back();
+        if (tail && current.base > 0) {
+            stack_[current.base - 1] = std::move(stack_[at]);
+            stack_.resize(current.base);
+            current.proto = proto;
+            current.ip = proto->code.data();
+            current.frame = frame;
+            return;
+        }
+        calls_.push_back({ proto, proto->code.data(), frame, stack_.size() });
+    } else if (callee->is<Fn>()) {
+        ObPtr result = (*callee->as<Fn>())(Args(stack_.data() + at + 1, argc),
+                                           *globals_);
+        stack_.resize(at);
+        stack_.push_back(result);
+    } else
+        throw NotFound("<function> " + callee->repr() + "()");
+}
+
+ObPtr VM::execute(const ProtoPtr& proto) {
+    FramePtr frame(new Frame(nullptr, proto->slots));
+    calls_.push_back({ proto.get(), proto->code.data(), frame, 0 });
+
+    for (;;) {
+        CallInfo& call = calls_.back();
+        const Instruction& ins = *call.ip++;
+        switch (ins.op) {
+            case OpCode::Const:
+                stack_.push_back(call.proto->constants[ins.a]);
+                break;
+            case OpCode::LoadLocal:
+            case OpCode::LoadOuter: {
+                Frame* frame = call.frame.get();
+                for (int depth = ins.b; depth > 0; depth--)
+                    frame = frame->parent.get();
+                const ObPtr& value = frame->slots[ins.a];
+                if (!value)
+                    throw NotFound("local used before its let* binding");
+                stack_.push_back(value);
+                break;
+            }
+            case OpCode::LoadIfBound: {
+                Frame* frame = call.frame.get();
+                for (int depth = ins.b; depth > 0; depth--)
+                    frame = frame->parent.get();
+                const ObPtr& value = frame->slots[ins.a];
+                if (value)
+                    stack_.push_back(value);
+                else
+                    call.ip++;
+                break;
+            }
+            case OpCode::StoreLocal:
+                call.frame->slots[ins.a] = std::move(stack_.back());
+                stack_.pop_back();
+                break;
+            case OpCode::LoadGlobal:
+                stack_.push_back(global(call.proto->globals[ins.a]));
+                break;
+            case OpCode::DefGlobal:
+                stack_.back() = promote(forceLazy(stack_.back()));
+                globals_->set(call.proto->globals[ins.a].symbol, stack_.back());
+                version_++;
+                break;
+            case OpCode::Pop:
+                stack_.pop_back();
+                break;
+            case OpCode::Jump:
+                call.ip = call.proto->code.data() + ins.a;
+                break;
+            case OpCode::JumpIfFalse: {
+                bool condition = truthy(stack_.back());
+                stack_.pop_back();
+                if (!condition)
+                    call.ip = call.proto->code.data() + ins.a;
+                break;
+            }
+            case OpCode::MakeClosure:
+                stack_.push_back(ObPtr(new CompiledFn(
+                    call.proto->protos[ins.a], call.frame)));
+                break;
+            case OpCode::MakeVector: {
+                ObPtr vector = newVector(stack_.end() - ins.a, stack_.end());
+                stack_.resize(stack_.size() - ins.a);
+                stack_.push_back(vector);
+                break;
+            }
+            case OpCode::MakeHashMap: {
+                ObPtr map = newHashMap();
+                std::size_t first = stack_.size() - 2 * ins.a;
+                for (std::size_t i = first; i < stack_.size(); i += 2)
+                    map->as<HashMap>()->set(stack_[i], stack_[i + 1]);
+                stack_.resize(first);
+                stack_.push_back(map);
+                break;
+            }
+            case OpCode::Call:
+            case OpCode::TailCall:
+                invoke(ins.a, ins.op == OpCode::TailCall);
+                break;
+            case OpCode::BinaryOp: {
+                ObPtr fn = global(call.proto->globals[ins.a]);
+                if (fn != intrinsics_[ins.b]) {
+                    stack_.insert(stack_.end() - 2, fn);
+                    invoke(2, false);
+                    break;
+                }
+                std::size_t top = stack_.size();
+                ObPtr result = applyIntrinsic(Intrinsic(ins.b),
+                                              stack_[top - 2], stack_[top - 1]);
+                stack_.pop_back();
+                stack_.back() = result;
+                break;
+            }
+            case OpCode::Return: {
+                ObPtr result = std::move(stack_.back());
+                std::size_t base = call.base;
+                calls_.pop_back();
+                if (calls_.empty()) {
+                    stack_.clear();
+                    return result;
+                }
+                stack_.resize(base - 1);
+                stack_.push_back(result);
+                break;
+            }
+        }
+    }
+}
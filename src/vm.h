@@ -0,0 +1,54 @@
+#ifndef _VM_H_
+#define _VM_H_
+
+#include <memory>
+#include <vector>
+
+#include "collector.h"
+#include "compiler.h"
+#include "environment.h"
+#include "types.h"
+
+
+// Local variables of one call. Closures keep the frame they were created
+// in, which is the parent frame of each of their calls.
+struct Frame : Collectable {
+    std::shared_ptr<Frame> parent;
+    std::vector<ObPtr> slots;
+
+    Frame(std::shared_ptr<Frame> parent, std::size_t size)
+        : parent(std::move(parent)), slots(size) { };
+
+    void references(std::vector<const ObPtr*>& values,
+                    std::vector<const Collectable*>& frames) const;
+    void dropReferences();
+};
+
+typedef std::shared_ptr<Frame> FramePtr;
+
+
+// Stack machine running code produced by compile(). Globals live in the
+// same Env chain the tree-walking EVAL uses.
+class VM {
+    struct CallInfo {
+        Proto* proto;
+        const Instruction* ip;
+        FramePtr frame;
+        std::size_t base;   // stack index of the first temporary
+    };
+
+    EnvPtr globals_;
+    unsigned version_;      // bumped by each def!, invalidates GlobalRefs
+    ObPtr intrinsics_[unsigned(Intrinsic::Count)];
+    std::vector<ObPtr> stack_;
+    std::vector<CallInfo> calls_;
+
+    const ObPtr& global(GlobalRef& ref);
+    void invoke(std::size_t argc, bool tail);
+    ObPtr execute(const ProtoPtr& proto);
+public:
+    VM(EnvPtr globals);
+    ObPtr run(ObPtr ast);
+};
+
+#endif